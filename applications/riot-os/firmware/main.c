@@ -31,11 +31,16 @@ int load(int argc, char **argv);
 int store(int argc, char **argv);
 int calibrate(int argc, char **argv);
 int zero(int argc, char **argv);
+int sample(int argc, char **argv);
 int info(int argc, char **argv);
 int level(int argc, char **argv);
 int temperature(int argc, char **argv);
+int wet(int argc, char **argv);
+int faults(int argc, char **argv);
 int level_raw(int argc, char **argv);
 int temperature_raw(int argc, char **argv);
+int level_stats(int argc, char **argv);
+int temperature_stats(int argc, char **argv);
 int config(int argc, char **argv);
 int level_config(int argc, char **argv);
 int temperature_config(int argc, char **argv);
@@ -61,11 +66,16 @@ static const shell_command_t shell_commands[] = {
     { "store", "Store configuration command", store },
     { "calibrate", "Calibrate water sensor", calibrate },
     { "zero", "Zero min/max", zero },
+    { "sample", "Sample and read the local channels", sample },
     { "info", "Read water sensor info", info },
     { "level", "Read the level", level },
     { "temperature", "Read the temperature", temperature },
+    { "wet", "Read the wet channels", wet },
+    { "faults", "Read the faulty channels", faults },
     { "level_raw", "Read the level raw", level_raw },
     { "temperature_raw", "Read the temperature raw", temperature_raw },
+    { "level_stats", "Read the level statistics", level_stats },
+    { "temperature_stats", "Read the temperature statistics", temperature_stats },
     { "config", "Read or write global config", config },
     { "level_config", "Read or write level config", level_config },
     { "temperature_config", "Read or write temperature config", temperature_config },
@@ -165,6 +175,38 @@ int zero(int argc, char **argv)
     return 0;
 }
 
+int sample(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    int result = water_sensor_sample(&dev);
+
+    if (result != WATER_SENSOR_OK) {
+        printf("error: return code %d\n", result);
+        return 1;
+    }
+
+    water_sensor_snapshot_t snapshot;
+
+    result = water_sensor_read_latched(&dev, &snapshot);
+
+    if (result != WATER_SENSOR_OK) {
+        printf("error: return code %d\n", result);
+        return 1;
+    }
+
+    printf("Channel\tValue\tValid\n");
+
+    for (unsigned i = 0; i < WATER_SENSOR_CHANNELS; i++) {
+        printf("%02d\t%d\t%s\n", i, snapshot.level[i].value, snapshot.level[i].valid ? "Y" : "N");
+    }
+
+    printf("Temperature: %d (%s)\n", snapshot.temperature.value, snapshot.temperature.valid ? "Y" : "N");
+
+    return 0;
+}
+
 int info(int argc, char **argv)
 {
     (void)argc;
@@ -183,6 +225,9 @@ int info(int argc, char **argv)
     printf("Level channels: %d\n", info.level_channels);
     printf("Temperature channels: %d\n", info.temperature_channels);
     printf("Enabled: %s\n", info.enabled ? "Y" : "N");
+    printf("Sequence: %u\n", info.sequence);
+    printf("Interval: %u ms\n", info.interval);
+    printf("Changes: %u\n", info.changes);
 
     printf("Errors: ");
 
@@ -221,6 +266,17 @@ int info(int argc, char **argv)
     return 0;
 }
 
+/* print a fixed point number with eight fractional bits */
+static void _print_fixed(int64_t value)
+{
+    if (value < 0) {
+        printf("-");
+        value = -value;
+    }
+
+    printf("%lu.%02u", (unsigned long)(value >> 8), (unsigned)(((value & 0xff) * 100) >> 8));
+}
+
 int level(int argc, char **argv)
 {
     (void)argc;
@@ -236,6 +292,9 @@ int level(int argc, char **argv)
     }
 
     printf("Level: %d\n", level.value);
+    printf("Interpolated: ");
+    _print_fixed(level.interpolated);
+    printf("\n");
     printf("Channel: %d\n", level.channel);
     printf("Valid: %s\n", level.valid ? "Y" : "N");
 
@@ -263,6 +322,52 @@ int temperature(int argc, char **argv)
     return 0;
 }
 
+int wet(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    uint32_t wet;
+
+    int result = water_sensor_read_wet(&dev, &wet);
+
+    if (result != WATER_SENSOR_OK) {
+        printf("error: return code %d\n", result);
+        return 1;
+    }
+
+    printf("Wet: 0x%08lx\n", (unsigned long)wet);
+    printf("Channels: ");
+
+    for (unsigned i = 0; i < (WATER_SENSOR_SENSORS * WATER_SENSOR_CHANNELS); i++) {
+        printf("%s", (wet & (1UL << i)) ? "W" : ".");
+    }
+
+    printf("\n");
+
+    return 0;
+}
+
+int faults(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    water_sensor_faults_t faults;
+
+    int result = water_sensor_read_faults(&dev, &faults);
+
+    if (result != WATER_SENSOR_OK) {
+        printf("error: return code %d\n", result);
+        return 1;
+    }
+
+    printf("Faults: 0x%08lx\n", (unsigned long)faults.channels);
+    printf("Confidence: %u%%\n", faults.confidence);
+
+    return 0;
+}
+
 int level_raw(int argc, char **argv)
 {
     unsigned start, stop;
@@ -359,6 +464,84 @@ int temperature_raw(int argc, char **argv)
     return 0;
 }
 
+int level_stats(int argc, char **argv)
+{
+    unsigned start, stop;
+
+    if (argc == 1) {
+        start = 0;
+        stop = dev_info.level_channels;
+    } else if (argc == 2) {
+        int channel = atoi(argv[1]);
+
+        start = channel;
+        stop = channel + 1;
+    } else {
+        printf("usage: %s [<channel>]\n", argv[0]);
+        return 0;
+    }
+
+    water_sensor_statistics_t statistics;
+
+    printf("Channel\tCount\tMean\tVariance\n");
+
+    for (unsigned i = start; i < stop; i++) {
+        int result = water_sensor_read_level_statistics(&dev, i, &statistics);
+
+        if (result != WATER_SENSOR_OK) {
+            printf("error: return code %d\n", result);
+            return 1;
+        }
+
+        printf("%02d\t%d\t", i, statistics.count);
+        _print_fixed(statistics.mean);
+        printf("\t");
+        _print_fixed(statistics.variance);
+        printf("\n");
+    }
+
+    return 0;
+}
+
+int temperature_stats(int argc, char **argv)
+{
+    unsigned start, stop;
+
+    if (argc == 1) {
+        start = 0;
+        stop = dev_info.temperature_channels;
+    } else if (argc == 2) {
+        int channel = atoi(argv[1]);
+
+        start = channel;
+        stop = channel + 1;
+    } else {
+        printf("usage: %s [<channel>]\n", argv[0]);
+        return 0;
+    }
+
+    water_sensor_statistics_t statistics;
+
+    printf("Channel\tCount\tMean\tVariance\n");
+
+    for (unsigned i = start; i < stop; i++) {
+        int result = water_sensor_read_temperature_statistics(&dev, i, &statistics);
+
+        if (result != WATER_SENSOR_OK) {
+            printf("error: return code %d\n", result);
+            return 1;
+        }
+
+        printf("%02d\t%d\t", i, statistics.count);
+        _print_fixed(statistics.mean);
+        printf("\t");
+        _print_fixed(statistics.variance);
+        printf("\n");
+    }
+
+    return 0;
+}
+
 int config_get(int argc, char **argv)
 {
     (void) argc;
@@ -374,20 +557,31 @@ int config_get(int argc, char **argv)
     }
 
     printf("Default level: %d\n", config.default_level);
+    printf("Interval: %u-%u ms\n", config.min_interval, config.max_interval);
+    printf("Noise target: %u/16\n", config.noise_target);
+    printf("Sample budget: %u\n", config.sample_budget);
+    printf("Compensation temperature: %d\n", config.compensation_temperature);
+    printf("Interpolation: %s\n", config.interpolation ? "Y" : "N");
 
     return 0;
 }
 
 int config_set(int argc, char **argv)
 {
-    if (argc < 3) {
-        printf("usage: %s %s <default level>\n", argv[0], argv[1]);
+    if (argc < 9) {
+        printf("usage: %s %s <default level> <min interval> <max interval> <noise target> <sample budget> <compensation temperature> <interpolation>\n", argv[0], argv[1]);
         return 0;
     }
 
     water_sensor_config_t config;
 
     config.default_level = atoi(argv[2]);
+    config.min_interval = atoi(argv[3]);
+    config.max_interval = atoi(argv[4]);
+    config.noise_target = atoi(argv[5]);
+    config.sample_budget = atoi(argv[6]);
+    config.compensation_temperature = atoi(argv[7]);
+    config.interpolation = atoi(argv[8]);
 
     int result = water_sensor_write_config(&dev, &config);
 
@@ -437,7 +631,7 @@ int level_config_get(int argc, char **argv)
 
     water_sensor_level_config_t config;
 
-    printf("Channel\tEnabled\tSamples\tAlpha\tOffset\tLevel\n");
+    printf("Channel\tEnabled\tSamples\tFilter\tAlpha\tPeriod\tRes\tOffset\tLevel\tComp\tCoeff\tCal\tDry\tWet\tHyst\tDeb\n");
 
     for (unsigned i = start; i < stop; i++) {
         int result = water_sensor_read_level_config(&dev, i, &config);
@@ -447,7 +641,7 @@ int level_config_get(int argc, char **argv)
             return 1;
         }
 
-        printf("%02d\t%s\t%d\t%d\t%d\t%d\n", i, config.enabled ? "Y" : "N", config.samples, config.alpha, config.offset, config.level);
+        printf("%02d\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", i, config.enabled ? "Y" : "N", config.samples, config.filter, config.alpha, config.period, config.resolution, config.offset, config.level, config.compensation, config.coefficient, config.calibration, config.dry, config.wet, config.hysteresis, config.debounce);
     }
 
     return 0;
@@ -455,8 +649,8 @@ int level_config_get(int argc, char **argv)
 
 int level_config_set(int argc, char **argv)
 {
-    if (argc < 8) {
-        printf("usage: %s %s <channel> <enabled> <samples> <alpha> <offset> <level>\n", argv[0], argv[1]);
+    if (argc < 18) {
+        printf("usage: %s %s <channel> <enabled> <samples> <filter> <alpha> <period> <resolution> <offset> <level> <compensation> <coefficient> <calibration> <dry> <wet> <hysteresis> <debounce>\n", argv[0], argv[1]);
         return 0;
     }
 
@@ -466,9 +660,19 @@ int level_config_set(int argc, char **argv)
 
     config.enabled = atoi(argv[3]);
     config.samples = atoi(argv[4]);
-    config.alpha = atoi(argv[5]);
-    config.offset = atoi(argv[6]);
-    config.level = atoi(argv[7]);
+    config.filter = atoi(argv[5]);
+    config.alpha = atoi(argv[6]);
+    config.period = atoi(argv[7]);
+    config.resolution = atoi(argv[8]);
+    config.offset = atoi(argv[9]);
+    config.level = atoi(argv[10]);
+    config.compensation = atoi(argv[11]);
+    config.coefficient = atoi(argv[12]);
+    config.calibration = atoi(argv[13]);
+    config.dry = atoi(argv[14]);
+    config.wet = atoi(argv[15]);
+    config.hysteresis = atoi(argv[16]);
+    config.debounce = atoi(argv[17]);
 
     int result = water_sensor_write_level_config(&dev, channel, &config);
 
@@ -518,7 +722,7 @@ int temperature_config_get(int argc, char **argv)
 
     water_sensor_temperature_config_t config;
 
-    printf("Channel\tEnabled\tAlpha\tReference\n");
+    printf("Channel\tEnabled\tFilter\tAlpha\tPeriod\tReference\n");
 
     for (unsigned i = start; i < stop; i++) {
         int result = water_sensor_read_temperature_config(&dev, i, &config);
@@ -528,7 +732,7 @@ int temperature_config_get(int argc, char **argv)
             return 1;
         }
 
-        printf("%02d\t%s\t%d\t%d\n", i, config.enabled ? "Y" : "N", config.alpha, config.reference);
+        printf("%02d\t%s\t%d\t%d\t%d\t%d\n", i, config.enabled ? "Y" : "N", config.filter, config.alpha, config.period, config.reference);
     }
 
     return 0;
@@ -536,8 +740,8 @@ int temperature_config_get(int argc, char **argv)
 
 int temperature_config_set(int argc, char **argv)
 {
-    if (argc < 6) {
-        printf("usage: %s %s <channel> <enabled> <alpha> <reference>\n", argv[0], argv[1]);
+    if (argc < 8) {
+        printf("usage: %s %s <channel> <enabled> <filter> <alpha> <period> <reference>\n", argv[0], argv[1]);
         return 0;
     }
 
@@ -546,8 +750,10 @@ int temperature_config_set(int argc, char **argv)
     water_sensor_temperature_config_t config;
 
     config.enabled = atoi(argv[3]);
-    config.alpha = atoi(argv[4]);
-    config.reference = atoi(argv[5]);
+    config.filter = atoi(argv[4]);
+    config.alpha = atoi(argv[5]);
+    config.period = atoi(argv[6]);
+    config.reference = atoi(argv[7]);
 
     int result = water_sensor_write_temperature_config(&dev, channel, &config);
 
@@ -585,9 +791,7 @@ int monitor(int argc, char **argv)
 
     char buffer[3][32];
 
-    water_sensor_level_t level;
-    water_sensor_level_raw_t level_raw;
-    water_sensor_temperature_t temperature;
+    static water_sensor_state_t state;
 
     puts("Reset board to restart shell.");
 
@@ -611,20 +815,18 @@ int monitor(int argc, char **argv)
     u8g2_SetPowerSave(&u8g2, 0);
 
     while (1) {
-        int result = water_sensor_read_level(&dev, &level);
+        /* read the state of all channels in a few transfers */
+        int result = water_sensor_read_state(&dev, &state);
 
         if (result != WATER_SENSOR_OK) {
             printf("error: return code %d\n", result);
         }
 
-        result = water_sensor_read_temperature(&dev, &temperature);
-
-        if (result != WATER_SENSOR_OK) {
-            printf("error: return code %d\n", result);
-        }
+        water_sensor_level_t *level = &state.level;
+        water_sensor_temperature_t *temperature = &state.temperature;
 
-        snprintf(buffer[0], 32, "%i (%d, %s)", level.value, level.channel, level.valid ? "Y" : "N");
-        snprintf(buffer[1], 32, "%i.%02i C (%d, %s)", temperature.value / 100, temperature.value % 100, temperature.channel, temperature.valid ? "Y" : "N");
+        snprintf(buffer[0], 32, "%i (%d, %s)", level->value, level->channel, level->valid ? "Y" : "N");
+        snprintf(buffer[1], 32, "%i.%02i C (%d, %s)", temperature->value / 100, temperature->value % 100, temperature->channel, temperature->valid ? "Y" : "N");
 
         u8g2_FirstPage(&u8g2);
 
@@ -642,15 +844,11 @@ int monitor(int argc, char **argv)
 
             u8g2_SetFont(&u8g2, u8g2_font_helvB08_tf);
 
-            for (int i = 0; i < dev_info.level_channels; i++) {
-                result = water_sensor_read_level_raw(&dev, i, &level_raw);
-
-                if (result != WATER_SENSOR_OK) {
-                    printf("error: return code %d\n", result);
-                }
+            for (int i = 0; i < state.info.level_channels; i++) {
+                water_sensor_level_raw_t *level_raw = &state.snapshots[i / WATER_SENSOR_CHANNELS].level[i % WATER_SENSOR_CHANNELS];
 
-                snprintf(buffer[2], 32, "%d: %d (%s) %s %d/%d/%d", i, level_raw.value, level.valid ? "Y" : "N", i == level.channel ? "<--" : "   ",
-                    level_raw.min, level_raw.max, level_raw.max - level_raw.min);
+                snprintf(buffer[2], 32, "%d: %d (%s) %s %d/%d/%d", i, level_raw->value, level->valid ? "Y" : "N", i == level->channel ? "<--" : "   ",
+                    level_raw->min, level_raw->max, level_raw->max - level_raw->min);
 
                 u8g2_DrawStr(&u8g2, 2, 55 + (i * 9), buffer[2]);
             }
@@ -21,6 +21,8 @@
 #include "water_sensor.h"
 #include "water_sensor_internals.h"
 
+#include "xtimer.h"
+
 #define ENABLE_DEBUG 0
 #include "debug.h"
 
@@ -38,6 +40,29 @@ static uint8_t _checksum(const uint8_t *data, size_t length)
     return checksum;
 }
 
+static void _parse_snapshot(const uint8_t *buf, water_sensor_snapshot_t *out)
+{
+    uint8_t valid = buf[WATER_SENSOR_SNAPSHOT_VALID];
+
+    for (unsigned j = 0; j < WATER_SENSOR_CHANNELS; j++) {
+        const uint8_t *p = &buf[j * 6];
+
+        out->level[j].value = (p[0] << 8) | p[1];
+        out->level[j].min = (p[2] << 8) | p[3];
+        out->level[j].max = (p[4] << 8) | p[5];
+        out->level[j].valid = (valid & (1 << j)) != 0;
+    }
+
+    const uint8_t *p = &buf[WATER_SENSOR_SNAPSHOT_TEMPERATURE];
+
+    out->temperature.value = (p[0] << 8) | p[1];
+    out->temperature.min = (p[2] << 8) | p[3];
+    out->temperature.max = (p[4] << 8) | p[5];
+    out->temperature.valid = (valid & (1 << WATER_SENSOR_SNAPSHOT_VALID_TEMPERATURE)) != 0;
+
+    out->latch = (valid >> WATER_SENSOR_SNAPSHOT_LATCH_SHIFT) & WATER_SENSOR_SNAPSHOT_LATCH_MASK;
+}
+
 static int _cmd(const water_sensor_t *dev, uint8_t cmd)
 {
     int result;
@@ -49,48 +74,163 @@ static int _cmd(const water_sensor_t *dev, uint8_t cmd)
     return result;
 }
 
-static int _read_reg(const water_sensor_t *dev, uint8_t reg, void *data, size_t length)
+static int _read_reg(const water_sensor_t *dev, uint16_t reg, void *data, size_t length)
 {
     int result;
 
     i2c_acquire(WATER_SENSOR_I2C);
-    result = i2c_read_regs(WATER_SENSOR_I2C, WATER_SENSOR_ADDR, reg, data, length, 0);
+    result = i2c_read_regs(WATER_SENSOR_I2C, WATER_SENSOR_ADDR, reg, data, length, I2C_REG16);
     i2c_release(WATER_SENSOR_I2C);
 
     return result;
 }
 
-static int _read_reg16(const water_sensor_t *dev, uint16_t reg, void *data, size_t length)
+static int _write_reg(const water_sensor_t *dev, uint16_t reg, const void *data, size_t length)
 {
     int result;
 
     i2c_acquire(WATER_SENSOR_I2C);
-    result = i2c_read_regs(WATER_SENSOR_I2C, WATER_SENSOR_ADDR, reg, data, length, I2C_REG16);
+    result = i2c_write_regs(WATER_SENSOR_I2C, WATER_SENSOR_ADDR, reg, data, length, I2C_REG16);
     i2c_release(WATER_SENSOR_I2C);
 
     return result;
 }
 
-static int _write_reg(const water_sensor_t *dev, uint8_t reg, const void *data, size_t length)
+static int _read_register(const water_sensor_t *dev, uint16_t reg, uint8_t *data, size_t length)
 {
-    int result;
+    uint32_t start = xtimer_now_usec();
 
-    i2c_acquire(WATER_SENSOR_I2C);
-    result = i2c_write_regs(WATER_SENSOR_I2C, WATER_SENSOR_ADDR, reg, data, length, 0);
-    i2c_release(WATER_SENSOR_I2C);
+    /* a register that is prepared when it is selected (and the info register
+       while a state is published) reads with an invalid checksum until it
+       is ready, so read until it is valid */
+    do {
+        if (_read_reg(dev, reg, data, length) != 0) {
+            return WATER_SENSOR_ERR_I2C;
+        }
 
-    return result;
+        if (_checksum(data, length - 1) == data[length - 1]) {
+            return WATER_SENSOR_OK;
+        }
+
+        xtimer_msleep(WATER_SENSOR_WAIT_INTERVAL);
+    } while (xtimer_now_usec() - start < (WATER_SENSOR_WAIT_TIMEOUT * US_PER_MS));
+
+    return WATER_SENSOR_ERR_TIMEOUT;
 }
 
-static int _write_reg16(const water_sensor_t *dev, uint16_t reg, const void *data, size_t length)
+/* The state is read in several transfers: the info register up to the wet
+   register, every snapshot and the faults. Every transfer holds whole
+   registers of one state, and the first one holds a valid info register of
+   that state. The others are of that state too if the info register still
+   holds the same sequence number after them (see water_sensor_read_state()). */
+static int _read_state(const water_sensor_t *dev, water_sensor_state_t *out)
 {
-    int result;
+    /* info, level, temperature and wet are read at once */
+    uint8_t buf[WATER_SENSOR_REG_SNAPSHOT(0) - WATER_SENSOR_REG_INFO];
 
-    i2c_acquire(WATER_SENSOR_I2C);
-    result = i2c_write_regs(WATER_SENSOR_I2C, WATER_SENSOR_ADDR, reg, data, length, I2C_REG16);
-    i2c_release(WATER_SENSOR_I2C);
+    if (_read_reg(dev, WATER_SENSOR_REG_INFO, buf, sizeof(buf)) != 0) {
+        DEBUG("[water_sensor] _read_state: failed\n");
+        return WATER_SENSOR_ERR_I2C;
+    }
 
-    return result;
+    /* the info register is invalid while a state is published */
+    if (_checksum(&buf[WATER_SENSOR_REG_INFO], WATER_SENSOR_INFO_SIZE) != buf[WATER_SENSOR_REG_INFO + WATER_SENSOR_INFO_SIZE]) {
+        DEBUG("[water_sensor] _read_state: state is being published\n");
+        return WATER_SENSOR_ERR_BUSY;
+    }
+
+    if (_checksum(&buf[WATER_SENSOR_REG_LEVEL], WATER_SENSOR_LEVEL_SIZE) != buf[WATER_SENSOR_REG_LEVEL + WATER_SENSOR_LEVEL_SIZE] ||
+        _checksum(&buf[WATER_SENSOR_REG_TEMPERATURE], WATER_SENSOR_TEMPERATURE_SIZE) != buf[WATER_SENSOR_REG_TEMPERATURE + WATER_SENSOR_TEMPERATURE_SIZE] ||
+        _checksum(&buf[WATER_SENSOR_REG_WET], WATER_SENSOR_WET_SIZE) != buf[WATER_SENSOR_REG_WET + WATER_SENSOR_WET_SIZE]) {
+        DEBUG("[water_sensor] _read_state: checksum error\n");
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    const uint8_t *p = &buf[WATER_SENSOR_REG_INFO];
+
+    out->info.id = p[0];
+    out->info.level_channels = p[1];
+    out->info.temperature_channels = p[2];
+    out->info.enabled = p[3];
+    out->info.errors = p[4];
+    out->info.context = p[5];
+    out->info.sequence = (p[6] << 8) | p[7];
+    out->info.interval = (p[8] << 8) | p[9];
+    out->info.changes = (p[10] << 8) | p[11];
+
+    p = &buf[WATER_SENSOR_REG_LEVEL];
+
+    out->level.value = (p[0] << 8) | p[1];
+    out->level.channel = p[2];
+    out->level.valid = p[3] != 0;
+    out->level.interpolated = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+
+    p = &buf[WATER_SENSOR_REG_TEMPERATURE];
+
+    out->temperature.value = (p[0] << 8) | p[1];
+    out->temperature.channel = p[2];
+    out->temperature.valid = p[3] != 0;
+
+    p = &buf[WATER_SENSOR_REG_WET];
+
+    out->wet = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+
+    if (out->info.temperature_channels > WATER_SENSOR_SENSORS) {
+        DEBUG("[water_sensor] _read_state: too many sensors\n");
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    /* followed by one snapshot per sensor */
+    for (unsigned i = 0; i < out->info.temperature_channels; i++) {
+        if (water_sensor_read_snapshot(dev, i, &out->snapshots[i]) != WATER_SENSOR_OK) {
+            DEBUG("[water_sensor] _read_state: snapshot failed\n");
+            return WATER_SENSOR_ERR_I2C;
+        }
+    }
+
+    /* and the faults */
+    if (water_sensor_read_faults(dev, &out->faults) != WATER_SENSOR_OK) {
+        DEBUG("[water_sensor] _read_state: faults failed\n");
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    return WATER_SENSOR_OK;
+}
+
+static int _wait_status(const water_sensor_t *dev, uint8_t index, uint32_t timeout)
+{
+    water_sensor_status_t status;
+    uint32_t start = xtimer_now_usec();
+
+    /* commands and writes are executed in the background, so poll until it
+       completes */
+    do {
+        if (water_sensor_read_status(dev, &status) != WATER_SENSOR_OK) {
+            return WATER_SENSOR_ERR_I2C;
+        }
+
+        uint8_t result = index == WATER_SENSOR_STATUS_WRITE ? status.write : status.commands[index];
+
+        if (result == WATER_SENSOR_STATUS_DONE) {
+            return WATER_SENSOR_OK;
+        }
+        else if (result != WATER_SENSOR_STATUS_PENDING) {
+            DEBUG("[water_sensor] _wait_status: status %d failed\n", index);
+            return WATER_SENSOR_ERR_FAILED;
+        }
+
+        xtimer_msleep(WATER_SENSOR_WAIT_INTERVAL);
+    } while (xtimer_now_usec() - start < (timeout * US_PER_MS));
+
+    DEBUG("[water_sensor] _wait_status: status %d timed out\n", index);
+    return WATER_SENSOR_ERR_TIMEOUT;
+}
+
+static int _wait(const water_sensor_t *dev, uint8_t cmd)
+{
+    uint32_t timeout = cmd == WATER_SENSOR_STORE ? WATER_SENSOR_STORE_TIMEOUT : WATER_SENSOR_WAIT_TIMEOUT;
+
+    return _wait_status(dev, WATER_SENSOR_COMMAND_INDEX(cmd), timeout);
 }
 
 int water_sensor_init(water_sensor_t *dev, const water_sensor_params_t *params)
@@ -132,7 +272,7 @@ int water_sensor_reset(const water_sensor_t *dev)
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return _wait(dev, WATER_SENSOR_RESET);
 }
 
 int water_sensor_enable(const water_sensor_t *dev)
@@ -142,7 +282,7 @@ int water_sensor_enable(const water_sensor_t *dev)
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return _wait(dev, WATER_SENSOR_ENABLE);
 }
 
 int water_sensor_load(const water_sensor_t *dev)
@@ -152,7 +292,7 @@ int water_sensor_load(const water_sensor_t *dev)
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return _wait(dev, WATER_SENSOR_LOAD);
 }
 
 int water_sensor_store(const water_sensor_t *dev)
@@ -162,7 +302,7 @@ int water_sensor_store(const water_sensor_t *dev)
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return _wait(dev, WATER_SENSOR_STORE);
 }
 
 int water_sensor_calibrate(const water_sensor_t *dev)
@@ -172,7 +312,7 @@ int water_sensor_calibrate(const water_sensor_t *dev)
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return _wait(dev, WATER_SENSOR_CALIBRATE);
 }
 
 int water_sensor_zero(const water_sensor_t *dev)
@@ -182,7 +322,17 @@ int water_sensor_zero(const water_sensor_t *dev)
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return _wait(dev, WATER_SENSOR_ZERO);
+}
+
+int water_sensor_sample(const water_sensor_t *dev)
+{
+    if (_cmd(dev, WATER_SENSOR_SAMPLE) != 0) {
+        DEBUG("[water_sensor] water_sensor_sample: failed\n");
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    return _wait(dev, WATER_SENSOR_SAMPLE);
 }
 
 int water_sensor_read_info(const water_sensor_t *dev, water_sensor_info_t *out)
@@ -191,14 +341,12 @@ int water_sensor_read_info(const water_sensor_t *dev, water_sensor_info_t *out)
 
     uint8_t buf[WATER_SENSOR_INFO_SIZE + 1];
 
-    if (_read_reg(dev, WATER_SENSOR_READ_INFO, buf, sizeof(buf)) != 0) {
-        DEBUG("[water_sensor] water_sensor_read_info: failed\n");
-        return WATER_SENSOR_ERR_I2C;
-    }
+    /* the info register reads as invalid while the state is published */
+    int result = _read_register(dev, WATER_SENSOR_REG_INFO, buf, sizeof(buf));
 
-    if (_checksum(buf, WATER_SENSOR_INFO_SIZE) != buf[6]) {
-        DEBUG("[water_sensor] water_sensor_read_info: checksum error\n");
-        return WATER_SENSOR_ERR_I2C;
+    if (result != WATER_SENSOR_OK) {
+        DEBUG("[water_sensor] water_sensor_read_info: failed\n");
+        return result;
     }
 
     out->id = buf[0];
@@ -207,6 +355,9 @@ int water_sensor_read_info(const water_sensor_t *dev, water_sensor_info_t *out)
     out->enabled = buf[3];
     out->errors = buf[4];
     out->context = buf[5];
+    out->sequence = (buf[6] << 8) | buf[7];
+    out->interval = (buf[8] << 8) | buf[9];
+    out->changes = (buf[10] << 8) | buf[11];
 
     return WATER_SENSOR_OK;
 }
@@ -217,12 +368,12 @@ int water_sensor_read_level(const water_sensor_t *dev, water_sensor_level_t *out
 
     uint8_t buf[WATER_SENSOR_LEVEL_SIZE + 1];
 
-    if (_read_reg(dev, WATER_SENSOR_READ_LEVEL, buf, sizeof(buf)) != 0) {
+    if (_read_reg(dev, WATER_SENSOR_REG_LEVEL, buf, sizeof(buf)) != 0) {
         DEBUG("[water_sensor] water_sensor_read_level: failed\n");
         return WATER_SENSOR_ERR_I2C;
     }
 
-    if (_checksum(buf, WATER_SENSOR_TEMPERATURE_SIZE) != buf[4]) {
+    if (_checksum(buf, WATER_SENSOR_LEVEL_SIZE) != buf[8]) {
         DEBUG("[water_sensor] water_sensor_read_level: checksum error\n");
         return WATER_SENSOR_ERR_I2C;
     }
@@ -230,6 +381,7 @@ int water_sensor_read_level(const water_sensor_t *dev, water_sensor_level_t *out
     out->value = (buf[0] << 8) | buf[1];
     out->channel = buf[2];
     out->valid = buf[3] != 0;
+    out->interpolated = ((uint32_t)buf[4] << 24) | ((uint32_t)buf[5] << 16) | ((uint32_t)buf[6] << 8) | buf[7];
 
     return WATER_SENSOR_OK;
 }
@@ -240,7 +392,7 @@ int water_sensor_read_temperature(const water_sensor_t *dev, water_sensor_temper
 
     uint8_t buf[WATER_SENSOR_TEMPERATURE_SIZE + 1];
 
-    if (_read_reg(dev, WATER_SENSOR_READ_TEMPERATURE, buf, sizeof(buf)) != 0) {
+    if (_read_reg(dev, WATER_SENSOR_REG_TEMPERATURE, buf, sizeof(buf)) != 0) {
         DEBUG("[water_sensor] water_sensor_read_temperature: failed\n");
         return WATER_SENSOR_ERR_I2C;
     }
@@ -257,27 +409,61 @@ int water_sensor_read_temperature(const water_sensor_t *dev, water_sensor_temper
     return WATER_SENSOR_OK;
 }
 
-int water_sensor_read_level_raw(const water_sensor_t *dev, uint8_t channel, water_sensor_level_raw_t *out)
+int water_sensor_read_wet(const water_sensor_t *dev, uint32_t *out)
 {
     assert(out != NULL);
 
-    uint8_t buf[WATER_SENSOR_LEVEL_RAW_SIZE + 1];
-    uint16_t reg = (WATER_SENSOR_READ_LEVEL_RAW << 8) | channel;
+    uint8_t buf[WATER_SENSOR_WET_SIZE + 1];
 
-    if (_read_reg16(dev, reg, buf, sizeof(buf)) != 0) {
-        DEBUG("[water_sensor] water_sensor_read_level_raw: failed\n");
+    if (_read_reg(dev, WATER_SENSOR_REG_WET, buf, sizeof(buf)) != 0) {
+        DEBUG("[water_sensor] water_sensor_read_wet: failed\n");
         return WATER_SENSOR_ERR_I2C;
     }
 
-    if (_checksum(buf, WATER_SENSOR_LEVEL_RAW_SIZE) != buf[7]) {
-        DEBUG("[water_sensor] water_sensor_read_level_raw: checksum error\n");
+    if (_checksum(buf, WATER_SENSOR_WET_SIZE) != buf[4]) {
+        DEBUG("[water_sensor] water_sensor_read_wet: checksum error\n");
         return WATER_SENSOR_ERR_I2C;
     }
 
-    out->value = (buf[0] << 8) | buf[1];
-    out->min = (buf[2] << 8) | buf[3];
-    out->max = (buf[4] << 8) | buf[5];
-    out->valid = buf[6] != 0;
+    *out = ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+
+    return WATER_SENSOR_OK;
+}
+
+int water_sensor_read_faults(const water_sensor_t *dev, water_sensor_faults_t *out)
+{
+    assert(out != NULL);
+
+    uint8_t buf[WATER_SENSOR_FAULTS_SIZE + 1];
+
+    if (_read_reg(dev, WATER_SENSOR_REG_FAULTS, buf, sizeof(buf)) != 0) {
+        DEBUG("[water_sensor] water_sensor_read_faults: failed\n");
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    if (_checksum(buf, WATER_SENSOR_FAULTS_SIZE) != buf[5]) {
+        DEBUG("[water_sensor] water_sensor_read_faults: checksum error\n");
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    out->channels = ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+    out->confidence = buf[4];
+
+    return WATER_SENSOR_OK;
+}
+
+int water_sensor_read_level_raw(const water_sensor_t *dev, uint8_t channel, water_sensor_level_raw_t *out)
+{
+    assert(out != NULL);
+
+    water_sensor_snapshot_t snapshot;
+
+    if (water_sensor_read_snapshot(dev, channel / WATER_SENSOR_CHANNELS, &snapshot) != WATER_SENSOR_OK) {
+        DEBUG("[water_sensor] water_sensor_read_level_raw: failed\n");
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    *out = snapshot.level[channel % WATER_SENSOR_CHANNELS];
 
     return WATER_SENSOR_OK;
 }
@@ -286,44 +472,157 @@ int water_sensor_read_temperature_raw(const water_sensor_t *dev, uint8_t channel
 {
     assert(out != NULL);
 
-    uint8_t buf[WATER_SENSOR_TEMPERATURE_RAW_SIZE + 1];
-    uint16_t reg = (WATER_SENSOR_READ_TEMPERATURE_RAW << 8) | channel;
+    water_sensor_snapshot_t snapshot;
 
-    if (_read_reg16(dev, reg, buf, sizeof(buf)) != 0) {
+    if (water_sensor_read_snapshot(dev, channel, &snapshot) != WATER_SENSOR_OK) {
         DEBUG("[water_sensor] water_sensor_read_temperature_raw: failed\n");
         return WATER_SENSOR_ERR_I2C;
     }
 
-    if (_checksum(buf, WATER_SENSOR_TEMPERATURE_RAW_SIZE) != buf[7]) {
-        DEBUG("[water_sensor] water_sensor_read_temperature_raw: checksum error\n");
+    *out = snapshot.temperature;
+
+    return WATER_SENSOR_OK;
+}
+
+static int _read_snapshot(const water_sensor_t *dev, uint16_t reg, water_sensor_snapshot_t *out)
+{
+    assert(out != NULL);
+
+    uint8_t buf[WATER_SENSOR_SNAPSHOT_SIZE + 1];
+    if (_read_reg(dev, reg, buf, sizeof(buf)) != 0) {
+        DEBUG("[water_sensor] _read_snapshot: failed\n");
         return WATER_SENSOR_ERR_I2C;
     }
 
-    out->value = (buf[0] << 8) | buf[1];
-    out->min = (buf[2] << 8) | buf[3];
-    out->max = (buf[4] << 8) | buf[5];
-    out->valid = buf[6] != 0;
+    if (_checksum(buf, WATER_SENSOR_SNAPSHOT_SIZE) != buf[WATER_SENSOR_SNAPSHOT_SIZE]) {
+        DEBUG("[water_sensor] _read_snapshot: checksum error\n");
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    _parse_snapshot(buf, out);
 
     return WATER_SENSOR_OK;
 }
 
-int water_sensor_read_config(const water_sensor_t *dev, water_sensor_config_t *out)
+int water_sensor_read_snapshot(const water_sensor_t *dev, uint8_t sensor, water_sensor_snapshot_t *out)
+{
+    return _read_snapshot(dev, WATER_SENSOR_REG_SNAPSHOT(sensor), out);
+}
+
+int water_sensor_read_latched(const water_sensor_t *dev, water_sensor_snapshot_t *out)
+{
+    return _read_snapshot(dev, WATER_SENSOR_REG_LATCHED, out);
+}
+
+int water_sensor_read_state(const water_sensor_t *dev, water_sensor_state_t *out)
 {
     assert(out != NULL);
 
-    uint8_t buf[WATER_SENSOR_CONFIG_SIZE + 1];
+    water_sensor_info_t info;
 
-    if (_read_reg(dev, WATER_SENSOR_READ_CONFIG, buf, sizeof(buf)) != 0) {
-        DEBUG("[water_sensor] water_sensor_read_config: failed\n");
+    /* the state is read in multiple transfers, so it is only consistent if
+       the sensor did not publish a new state in between */
+    for (unsigned i = 0; i < WATER_SENSOR_STATE_RETRIES; i++) {
+        int result = _read_state(dev, out);
+
+        if (result == WATER_SENSOR_ERR_BUSY) {
+            xtimer_msleep(WATER_SENSOR_WAIT_INTERVAL);
+            continue;
+        }
+
+        if (result != WATER_SENSOR_OK) {
+            return result;
+        }
+
+        if (water_sensor_read_info(dev, &info) != WATER_SENSOR_OK) {
+            return WATER_SENSOR_ERR_I2C;
+        }
+
+        if (info.sequence == out->info.sequence) {
+            return WATER_SENSOR_OK;
+        }
+    }
+
+    DEBUG("[water_sensor] water_sensor_read_state: state changed while reading\n");
+    return WATER_SENSOR_ERR_BUSY;
+}
+
+int water_sensor_read_status(const water_sensor_t *dev, water_sensor_status_t *out)
+{
+    assert(out != NULL);
+
+    uint8_t buf[WATER_SENSOR_STATUS_SIZE + 1];
+
+    if (_read_reg(dev, WATER_SENSOR_REG_STATUS, buf, sizeof(buf)) != 0) {
+        DEBUG("[water_sensor] water_sensor_read_status: failed\n");
         return WATER_SENSOR_ERR_I2C;
     }
 
-    if (_checksum(buf, WATER_SENSOR_CONFIG_SIZE) != buf[2]) {
-        DEBUG("[water_sensor] water_sensor_read_config: checksum error\n");
+    if (_checksum(buf, WATER_SENSOR_STATUS_SIZE) != buf[WATER_SENSOR_STATUS_SIZE]) {
+        DEBUG("[water_sensor] water_sensor_read_status: checksum error\n");
         return WATER_SENSOR_ERR_I2C;
     }
 
+    /* the upper bits count the received commands */
+    for (unsigned i = 0; i < WATER_SENSOR_COMMANDS; i++) {
+        out->commands[i] = buf[i] & WATER_SENSOR_STATUS_MASK;
+    }
+
+    out->write = buf[WATER_SENSOR_STATUS_WRITE] & WATER_SENSOR_STATUS_MASK;
+
+    return WATER_SENSOR_OK;
+}
+
+static int _read_statistics(const water_sensor_t *dev, uint16_t reg, water_sensor_statistics_t *out)
+{
+    assert(out != NULL);
+
+    uint8_t buf[WATER_SENSOR_STATISTICS_SIZE + 1];
+
+    int result = _read_register(dev, reg, buf, sizeof(buf));
+
+    if (result != WATER_SENSOR_OK) {
+        DEBUG("[water_sensor] _read_statistics: failed\n");
+        return result;
+    }
+
+    out->count = buf[0];
+    out->mean = ((uint32_t)buf[1] << 24) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 8) | buf[4];
+    out->variance = ((uint32_t)buf[5] << 24) | ((uint32_t)buf[6] << 16) | ((uint32_t)buf[7] << 8) | buf[8];
+
+    return WATER_SENSOR_OK;
+}
+
+int water_sensor_read_level_statistics(const water_sensor_t *dev, uint8_t channel, water_sensor_statistics_t *out)
+{
+    return _read_statistics(dev, WATER_SENSOR_REG_LEVEL_STATISTICS(channel), out);
+}
+
+int water_sensor_read_temperature_statistics(const water_sensor_t *dev, uint8_t channel, water_sensor_statistics_t *out)
+{
+    return _read_statistics(dev, WATER_SENSOR_REG_TEMPERATURE_STATISTICS(channel), out);
+}
+
+int water_sensor_read_config(const water_sensor_t *dev, water_sensor_config_t *out)
+{
+    assert(out != NULL);
+
+    uint8_t buf[WATER_SENSOR_CONFIG_SIZE + 1];
+
+    int result = _read_register(dev, WATER_SENSOR_REG_CONFIG, buf, sizeof(buf));
+
+    if (result != WATER_SENSOR_OK) {
+        DEBUG("[water_sensor] water_sensor_read_config: failed\n");
+        return result;
+    }
+
     out->default_level = (buf[0] << 8) | buf[1];
+    out->min_interval = (buf[2] << 8) | buf[3];
+    out->max_interval = (buf[4] << 8) | buf[5];
+    out->noise_target = buf[6];
+    out->sample_budget = (buf[7] << 8) | buf[8];
+    out->compensation_temperature = (buf[9] << 8) | buf[10];
+    out->interpolation = buf[11];
 
     return WATER_SENSOR_OK;
 }
@@ -336,14 +635,24 @@ int water_sensor_write_config(const water_sensor_t *dev, const water_sensor_conf
 
     buf[0] = (in->default_level & 0xff00) >> 8;
     buf[1] = (in->default_level & 0x00ff) >> 0;
-    buf[2] = _checksum(buf, WATER_SENSOR_CONFIG_SIZE);
-
-    if (_write_reg(dev, WATER_SENSOR_WRITE_CONFIG, buf, sizeof(buf)) != 0) {
+    buf[2] = (in->min_interval & 0xff00) >> 8;
+    buf[3] = (in->min_interval & 0x00ff) >> 0;
+    buf[4] = (in->max_interval & 0xff00) >> 8;
+    buf[5] = (in->max_interval & 0x00ff) >> 0;
+    buf[6] = in->noise_target;
+    buf[7] = (in->sample_budget & 0xff00) >> 8;
+    buf[8] = (in->sample_budget & 0x00ff) >> 0;
+    buf[9] = (in->compensation_temperature & 0xff00) >> 8;
+    buf[10] = (in->compensation_temperature & 0x00ff) >> 0;
+    buf[11] = in->interpolation;
+    buf[12] = _checksum(buf, WATER_SENSOR_CONFIG_SIZE);
+
+    if (_write_reg(dev, WATER_SENSOR_REG_CONFIG, buf, sizeof(buf)) != 0) {
         DEBUG("[water_sensor] water_sensor_write_config: failed\n");
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return _wait_status(dev, WATER_SENSOR_STATUS_WRITE, WATER_SENSOR_WAIT_TIMEOUT);
 }
 
 int water_sensor_read_level_config(const water_sensor_t *dev, uint8_t channel, water_sensor_level_config_t *out)
@@ -351,16 +660,12 @@ int water_sensor_read_level_config(const water_sensor_t *dev, uint8_t channel, w
     assert(out != NULL);
 
     uint8_t buf[WATER_SENSOR_LEVEL_CONFIG_SIZE + 1];
-    uint16_t reg = (WATER_SENSOR_READ_LEVEL_CONFIG << 8) | channel;
 
-    if (_read_reg16(dev, reg, buf, sizeof(buf)) != 0) {
-        DEBUG("[water_sensor] water_sensor_read_level_config: failed\n");
-        return WATER_SENSOR_ERR_I2C;
-    }
+    int result = _read_register(dev, WATER_SENSOR_REG_LEVEL_CONFIG(channel), buf, sizeof(buf));
 
-    if (_checksum(buf, WATER_SENSOR_LEVEL_CONFIG_SIZE) != buf[8]) {
-        DEBUG("[water_sensor] water_sensor_read_level_config: checksum error\n");
-        return WATER_SENSOR_ERR_I2C;
+    if (result != WATER_SENSOR_OK) {
+        DEBUG("[water_sensor] water_sensor_read_level_config: failed\n");
+        return result;
     }
 
     out->enabled = buf[0] != 0;
@@ -368,6 +673,16 @@ int water_sensor_read_level_config(const water_sensor_t *dev, uint8_t channel, w
     out->alpha = buf[3];
     out->offset = (buf[4] << 8) | buf[5];
     out->level = (buf[6] << 8) | buf[7];
+    out->filter = buf[8];
+    out->period = buf[9];
+    out->resolution = buf[10];
+    out->compensation = buf[11];
+    out->coefficient = (buf[12] << 8) | buf[13];
+    out->calibration = buf[14];
+    out->dry = (buf[15] << 8) | buf[16];
+    out->wet = (buf[17] << 8) | buf[18];
+    out->hysteresis = (buf[19] << 8) | buf[20];
+    out->debounce = buf[21];
 
     return WATER_SENSOR_OK;
 }
@@ -377,7 +692,6 @@ int water_sensor_write_level_config(const water_sensor_t *dev, uint8_t channel,
     assert(in != NULL);
 
     uint8_t buf[WATER_SENSOR_LEVEL_CONFIG_SIZE + 1];
-    uint16_t reg = (WATER_SENSOR_WRITE_LEVEL_CONFIG << 8) | channel;
 
     buf[0] = in->enabled ? 1 : 0;
     buf[1] = (in->samples & 0xff00) >> 8;
@@ -387,14 +701,28 @@ int water_sensor_write_level_config(const water_sensor_t *dev, uint8_t channel,
     buf[5] = (in->offset & 0x00ff) >> 0;
     buf[6] = (in->level & 0xff00) >> 8;
     buf[7] = (in->level & 0x00ff) >> 0;
-    buf[8] = _checksum(buf, WATER_SENSOR_LEVEL_CONFIG_SIZE);
-
-    if (_write_reg16(dev, reg, buf, sizeof(buf)) != 0) {
+    buf[8] = in->filter;
+    buf[9] = in->period;
+    buf[10] = in->resolution;
+    buf[11] = in->compensation;
+    buf[12] = (in->coefficient & 0xff00) >> 8;
+    buf[13] = (in->coefficient & 0x00ff) >> 0;
+    buf[14] = in->calibration;
+    buf[15] = (in->dry & 0xff00) >> 8;
+    buf[16] = (in->dry & 0x00ff) >> 0;
+    buf[17] = (in->wet & 0xff00) >> 8;
+    buf[18] = (in->wet & 0x00ff) >> 0;
+    buf[19] = (in->hysteresis & 0xff00) >> 8;
+    buf[20] = (in->hysteresis & 0x00ff) >> 0;
+    buf[21] = in->debounce;
+    buf[22] = _checksum(buf, WATER_SENSOR_LEVEL_CONFIG_SIZE);
+
+    if (_write_reg(dev, WATER_SENSOR_REG_LEVEL_CONFIG(channel), buf, sizeof(buf)) != 0) {
         DEBUG("[water_sensor] water_sensor_write_level_config: failed\n");
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return _wait_status(dev, WATER_SENSOR_STATUS_WRITE, WATER_SENSOR_WAIT_TIMEOUT);
 }
 
 int water_sensor_read_temperature_config(const water_sensor_t *dev, uint8_t channel, water_sensor_temperature_config_t *out)
@@ -402,21 +730,19 @@ int water_sensor_read_temperature_config(const water_sensor_t *dev, uint8_t chan
     assert(out != NULL);
 
     uint8_t buf[WATER_SENSOR_TEMPERATURE_CONFIG_SIZE + 1];
-    uint16_t reg = (WATER_SENSOR_READ_TEMPERATURE_CONFIG << 8) | channel;
 
-    if (_read_reg16(dev, reg, buf, sizeof(buf)) != 0) {
-        DEBUG("[water_sensor] water_sensor_read_temperature_config: failed\n");
-        return WATER_SENSOR_ERR_I2C;
-    }
+    int result = _read_register(dev, WATER_SENSOR_REG_TEMPERATURE_CONFIG(channel), buf, sizeof(buf));
 
-    if (_checksum(buf, WATER_SENSOR_TEMPERATURE_CONFIG_SIZE) != buf[4]) {
-        DEBUG("[water_sensor] water_sensor_read_temperature_config: checksum error\n");
-        return WATER_SENSOR_ERR_I2C;
+    if (result != WATER_SENSOR_OK) {
+        DEBUG("[water_sensor] water_sensor_read_temperature_config: failed\n");
+        return result;
     }
 
     out->enabled = buf[0] != 0;
     out->alpha = buf[1];
     out->reference = (buf[2] << 8) | buf[3];
+    out->filter = buf[4];
+    out->period = buf[5];
 
     return WATER_SENSOR_OK;
 }
@@ -426,18 +752,19 @@ int water_sensor_write_temperature_config(const water_sensor_t *dev, uint8_t cha
     assert(in != NULL);
 
     uint8_t buf[WATER_SENSOR_TEMPERATURE_CONFIG_SIZE + 1];
-    uint16_t reg = (WATER_SENSOR_WRITE_TEMPERATURE_CONFIG << 8) | channel;
 
     buf[0] = in->enabled ? 1 : 0;
     buf[1] = in->alpha;
     buf[2] = (in->reference & 0xff00) >> 8;
     buf[3] = (in->reference & 0x00ff) >> 0;
-    buf[4] = _checksum(buf, WATER_SENSOR_TEMPERATURE_CONFIG_SIZE);
+    buf[4] = in->filter;
+    buf[5] = in->period;
+    buf[6] = _checksum(buf, WATER_SENSOR_TEMPERATURE_CONFIG_SIZE);
 
-    if (_write_reg16(dev, reg, buf, sizeof(buf)) != 0) {
+    if (_write_reg(dev, WATER_SENSOR_REG_TEMPERATURE_CONFIG(channel), buf, sizeof(buf)) != 0) {
         DEBUG("[water_sensor] water_sensor_write_temperature_config: failed\n");
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return _wait_status(dev, WATER_SENSOR_STATUS_WRITE, WATER_SENSOR_WAIT_TIMEOUT);
 }
\ No newline at end of file
@@ -27,6 +27,8 @@
 
 #include "periph/i2c.h"
 
+#include "water_sensor_internals.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -38,8 +40,42 @@ enum {
     WATER_SENSOR_OK,                 /**< All OK */
     WATER_SENSOR_ERR_NODEV,          /**< No valid device found on I2C bus */
     WATER_SENSOR_ERR_I2C,            /**< An error occurred when reading/writing on I2C bus */
+    WATER_SENSOR_ERR_FAILED,         /**< The sensor failed to execute a command */
+    WATER_SENSOR_ERR_TIMEOUT,        /**< The sensor did not execute a command in time */
+    WATER_SENSOR_ERR_BUSY,           /**< The sensor state changed while reading it */
 };
 
+/**
+ * @brief Interval between polls while waiting for a command (in ms)
+ */
+#ifndef WATER_SENSOR_WAIT_INTERVAL
+#define WATER_SENSOR_WAIT_INTERVAL  (5U)
+#endif
+
+/**
+ * @brief Maximum time to wait for a command to complete (in ms)
+ */
+#ifndef WATER_SENSOR_WAIT_TIMEOUT
+#define WATER_SENSOR_WAIT_TIMEOUT   (5000U)
+#endif
+
+/**
+ * @brief Maximum time to wait for the configuration to be stored (in ms)
+ *
+ * Storing writes the EEPROM of the sensor and then of its children, which
+ * takes a few milliseconds per changed byte.
+ */
+#ifndef WATER_SENSOR_STORE_TIMEOUT
+#define WATER_SENSOR_STORE_TIMEOUT  (5000U)
+#endif
+
+/**
+ * @brief Number of attempts to read a consistent state
+ */
+#ifndef WATER_SENSOR_STATE_RETRIES
+#define WATER_SENSOR_STATE_RETRIES  (3U)
+#endif
+
 /**
  * @brief Device initialization parameters.
  */
@@ -62,12 +98,16 @@ typedef struct {
     bool enabled;
     uint8_t errors;
     uint8_t context;
+    uint16_t sequence;
+    uint16_t interval;
+    uint16_t changes;
 } water_sensor_info_t;
 
 typedef struct {
     int16_t value;
     int8_t channel;
     bool valid;
+    int32_t interpolated;
 } water_sensor_level_t;
 
 typedef struct {
@@ -90,21 +130,70 @@ typedef struct {
     bool valid;
 } water_sensor_temperature_raw_t;
 
+typedef struct {
+    water_sensor_level_raw_t level[WATER_SENSOR_CHANNELS];
+    water_sensor_temperature_raw_t temperature;
+    uint8_t latch;
+} water_sensor_snapshot_t;
+
+typedef struct {
+    uint32_t channels;
+    uint8_t confidence;
+} water_sensor_faults_t;
+
+typedef struct {
+    water_sensor_info_t info;
+    water_sensor_level_t level;
+    water_sensor_temperature_t temperature;
+    uint32_t wet;
+    water_sensor_snapshot_t snapshots[WATER_SENSOR_SENSORS];
+    water_sensor_faults_t faults;
+} water_sensor_state_t;
+
+typedef struct {
+    uint8_t commands[WATER_SENSOR_COMMANDS];
+    uint8_t write;
+} water_sensor_status_t;
+
+typedef struct {
+    uint8_t count;
+    int32_t mean;
+    uint32_t variance;
+} water_sensor_statistics_t;
+
 typedef struct {
     int16_t default_level;
+    uint16_t min_interval;
+    uint16_t max_interval;
+    uint8_t noise_target;
+    uint16_t sample_budget;
+    int16_t compensation_temperature;
+    uint8_t interpolation;
 } water_sensor_config_t;
 
 typedef struct {
     bool enabled;
     uint16_t samples;
+    uint8_t filter;
     uint8_t alpha;
+    uint8_t period;
+    uint8_t resolution;
     uint16_t offset;
     int16_t level;
+    uint8_t compensation;
+    int16_t coefficient;
+    uint8_t calibration;
+    uint16_t dry;
+    uint16_t wet;
+    uint16_t hysteresis;
+    uint8_t debounce;
 } water_sensor_level_config_t;
 
 typedef struct {
     bool enabled;
+    uint8_t filter;
     uint8_t alpha;
+    uint8_t period;
     uint16_t reference;
 } water_sensor_temperature_config_t;
 
@@ -115,11 +204,20 @@ int water_sensor_load(const water_sensor_t *dev);
 int water_sensor_store(const water_sensor_t *dev);
 int water_sensor_calibrate(const water_sensor_t *dev);
 int water_sensor_zero(const water_sensor_t *dev);
+int water_sensor_sample(const water_sensor_t *dev);
 int water_sensor_read_info(const water_sensor_t *dev, water_sensor_info_t *out);
 int water_sensor_read_level(const water_sensor_t *dev, water_sensor_level_t *out);
 int water_sensor_read_temperature(const water_sensor_t *dev, water_sensor_temperature_t *out);
+int water_sensor_read_wet(const water_sensor_t *dev, uint32_t *out);
+int water_sensor_read_faults(const water_sensor_t *dev, water_sensor_faults_t *out);
 int water_sensor_read_level_raw(const water_sensor_t *dev, uint8_t channel, water_sensor_level_raw_t *out);
 int water_sensor_read_temperature_raw(const water_sensor_t *dev, uint8_t channel, water_sensor_temperature_raw_t *out);
+int water_sensor_read_snapshot(const water_sensor_t *dev, uint8_t sensor, water_sensor_snapshot_t *out);
+int water_sensor_read_latched(const water_sensor_t *dev, water_sensor_snapshot_t *out);
+int water_sensor_read_state(const water_sensor_t *dev, water_sensor_state_t *out);
+int water_sensor_read_status(const water_sensor_t *dev, water_sensor_status_t *out);
+int water_sensor_read_level_statistics(const water_sensor_t *dev, uint8_t channel, water_sensor_statistics_t *out);
+int water_sensor_read_temperature_statistics(const water_sensor_t *dev, uint8_t channel, water_sensor_statistics_t *out);
 int water_sensor_read_config(const water_sensor_t *dev, water_sensor_config_t *out);
 int water_sensor_write_config(const water_sensor_t *dev, const water_sensor_config_t *in);
 int water_sensor_read_level_config(const water_sensor_t *dev, uint8_t channel, water_sensor_level_config_t *out);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "water_sensor_internals.h"
+
+#define FILTER_WINDOW WATER_SENSOR_FILTER_WINDOW
+
+// Filter state of one channel. The filter restarts when its type or
+// parameter changes, and the first sample fills the whole filter.
+typedef struct {
+    int16_t window[FILTER_WINDOW];
+    int32_t accumulator;
+    uint8_t index;
+    uint8_t type;
+    uint8_t alpha;
+    bool primed;
+} filter_t;
+
+void filterReset(filter_t *filter);
+int16_t filterApply(filter_t *filter, uint8_t type, uint8_t alpha, int16_t value);
@@ -2,8 +2,10 @@
 
 #include <stdint.h>
 
-#define NUM_SENSORS 8U
-#define NUM_CHANNELS 4U
+#include "water_sensor_internals.h"
+
+#define NUM_SENSORS WATER_SENSOR_SENSORS
+#define NUM_CHANNELS WATER_SENSOR_CHANNELS
 
 #define PIN_CONFIG_0 5
 #define PIN_CONFIG_1 6
@@ -13,9 +15,92 @@
 #define PIN_MASTER_SDA 8
 #define PIN_MASTER_SCL 9
 
+// I2C address of a sensor, by its index in the chain (zero is the parent).
+#define SENSOR_ADDRESS(index) (0x40 + ((index) << 2))
+
 #define PIN_TEMPERATURE 6
 
-#define CONFIG_MAGIC 0xbaab1234
+#define CONFIG_MAGIC 0xbaab123f
+
+#define COMMAND_QUEUE_SIZE 8
+#define COMMAND_PENDING -1
+
+#define UPDATE_INTERVAL 250
+#define UPDATE_INTERVAL_MAX 4000
+#define UPDATE_SLOT 10
+#define UPDATE_SLICE 1
+#define UPDATE_ATTEMPTS 10
+#define UPDATE_TIMEOUT(interval) (4 * (interval))
+
+// The published state registers: the info register up to and including the
+// faults register (see publishStateRegisters()).
+#define STATE_REGISTERS_SIZE WATER_SENSOR_REG_STATUS
+
+// Types of the registers that are prepared when they are selected (the
+// statistics and configuration registers), as located by their address.
+#define REGISTER_LEVEL_STATISTICS 0
+#define REGISTER_TEMPERATURE_STATISTICS 1
+#define REGISTER_CONFIG 2
+#define REGISTER_LEVEL_CONFIG 3
+#define REGISTER_TEMPERATURE_CONFIG 4
+
+// Status of the selected register, which is one of the registers that are not
+// kept serialized (the statistics and configuration registers). A register is
+// prepared once it is selected (serialized, or fetched from the child that
+// holds it), and prepared again when it is selected after it was read.
+#define SELECTED_IDLE 0
+#define SELECTED_PENDING 1
+#define SELECTED_READY 2
+#define SELECTED_SERVED 3
+#define SELECTED_FAILED 4
+
+// Phases of an operation on the children, which runs in the background. A
+// command is broadcast to all children (after the children are detected, for
+// a reset), and a register is written to one or all children, after which
+// the status of the children is polled until they executed it. Before a
+// command is broadcast, the count of received commands of every child is read
+// (see WATER_SENSOR_STATUS_COUNT_SHIFT), so that a child that missed it is
+// told from one that executed it. A register of a child is fetched until its
+// checksum is valid.
+#define OPERATION_IDLE 0
+#define OPERATION_DETECT 1
+#define OPERATION_BROADCAST 2
+#define OPERATION_WRITE 3
+#define OPERATION_STATUS 4
+#define OPERATION_FETCH 5
+#define OPERATION_COUNT 6
+
+// The running statistics weigh a new value with 1 / 2^STATISTICS_SHIFT,
+// where 2^STATISTICS_SHIFT is WATER_SENSOR_STATISTICS_WINDOW.
+#define STATISTICS_SHIFT 6
+
+// A channel changes quickly when its value moves more than its offset
+// divided by 2^UPDATE_CHANGE_SHIFT between two samples.
+#define UPDATE_CHANGE_SHIFT 5
+
+// Default number of intervals between two temperature samples.
+#define TEMPERATURE_PERIOD 20
+
+// Bounds of the number of samples of a level channel, when adapting it to the
+// noise of that channel.
+#define SAMPLES_MIN 4
+#define SAMPLES_BUDGET (NUM_CHANNELS * 60)
+
+// The temperature coefficients are learned over approximately the last
+// 2^COMPENSATION_WINDOW temperature samples, once the temperature varied by
+// at least one degree (variance in centi-degrees squared).
+#define COMPENSATION_WINDOW 8
+#define COMPENSATION_VARIANCE 10000
+#define COMPENSATION_TEMPERATURE 2000
+
+// The baselines follow new extremes with a weight of 1 / 2^CALIBRATION_ATTACK
+// and drift with a weight of 1 / 2^CALIBRATION_DRIFT. The offset is only
+// calibrated when the baselines are CALIBRATION_CONTRAST apart, and moves at
+// most CALIBRATION_STEP at a time (both in counts, without extra resolution).
+#define CALIBRATION_ATTACK 2
+#define CALIBRATION_DRIFT 6
+#define CALIBRATION_CONTRAST 64
+#define CALIBRATION_STEP 4
 
 typedef struct {
     uint8_t id;
@@ -23,56 +108,153 @@ typedef struct {
     uint8_t children;
 } info_t;
 
+// Configuration of the level channels of a sensor, that the parent needs to
+// determine the level. The parent holds it for its own channels and the
+// channels of every child, so the small fields are packed.
 typedef struct {
     struct {
-        bool enabled;
-        uint8_t samples;
-        uint8_t alpha;
+        uint8_t enabled : 1;
+        uint8_t resolution : 2;
+        uint8_t calibration : 2;
         uint16_t offset;
         int16_t level;
+        uint16_t dry;
+        uint16_t wet;
+        uint16_t hysteresis;
+        uint8_t debounce;
+    } adc[NUM_CHANNELS];
+} config_sensor_t;
+
+// Configuration of the sampling of the local channels. Every sensor only
+// holds its own, and the parent reads and writes the one of a child through
+// that child.
+typedef struct {
+    struct {
+        uint8_t samples;
+        uint8_t filter;
+        uint8_t alpha;
+        uint8_t period;
+        uint8_t compensation;
+        int16_t coefficient;
     } adc[NUM_CHANNELS];
 
     struct {
+        uint8_t filter;
         uint8_t alpha;
+        uint8_t period;
         uint16_t reference;
         bool enabled;
     } temperature;
-} config_sensor_t;
+} config_local_t;
 
 typedef struct {
     uint32_t magic;
 
     int16_t defaultLevel;
 
+    uint16_t minInterval;
+    uint16_t maxInterval;
+
+    uint8_t noiseTarget;
+    uint16_t sampleBudget;
+
+    int16_t compensationTemperature;
+
+    uint8_t interpolation;
+
+    config_local_t local;
     config_sensor_t sensors[NUM_SENSORS];
 } config_t;
 
+// Last values of a sensor. Their minimum and maximum are only kept in the
+// published snapshot of the sensor.
 typedef struct {
     struct {
         uint16_t value;
-        uint16_t min;
-        uint16_t max;
         bool valid;
+
+        // Number of consecutive samples on the other side of the offset.
+        uint8_t debounce;
     } adc[NUM_CHANNELS];
 
     struct {
         int16_t value;
-        int16_t min;
-        int16_t max;
         bool valid;
     } temperature;
+
+    uint32_t updated;
+
+    // Latch counter that the sensor should report for the current sample.
+    uint8_t latch;
 } state_sensor_t;
 
+// Running statistics of a channel. The mean is a moving average with eight
+// fractional bits. The deviation is the sum of the squared deviations from
+// the mean (also with eight fractional bits), of which a part is forgotten
+// with every value once the window is full.
+typedef struct {
+    uint8_t count;
+    int32_t mean;
+    uint32_t deviation;
+} statistics_t;
+
+// Register that contains an address. The index is the channel or sensor of
+// the register, for the types of which there are multiple.
+typedef struct {
+    uint8_t type;
+    uint8_t index;
+    uint16_t start;
+    uint8_t size;
+} register_location_t;
+
 typedef struct {
     bool enabled;
 
     uint8_t errors;
     uint8_t context;
 
+    uint16_t interval;
+    bool changing;
+
+    // The level channels that are enabled and have a valid value, and the
+    // ones of these that detect water, with bit N for channel N (of at most
+    // 32 channels). Channels that are enabled, but have no valid value (e.g.
+    // of a child that cannot be read), are invalid, and make the level invalid.
+    uint32_t active;
+    uint32_t wet;
+    uint32_t invalid;
+
+    // Level channels that changed, and sensors of which the temperature
+    // changed, since the level and temperature were last updated.
+    uint32_t changedChannels;
+    uint8_t changedSensors;
+
+    // Level channels and sensors (for the temperature) of which the minimum
+    // and maximum are reset when the snapshots are published next.
+    uint32_t zeroedChannels;
+    uint8_t zeroedSensors;
+
+    // Number of times that the level, temperature or wet channels changed.
+    uint16_t changes;
+
     struct {
         int16_t value;
         int8_t channel;
         bool valid;
+
+        // The level with eight fractional bits, which is interpolated using
+        // the boundary channel (the dry channel right above the water).
+        int32_t interpolated;
+        int8_t boundary;
+
+        // The wet channels that the level was determined from, the ones of
+        // these from the waterline up, and the channels that disagree with
+        // the waterline. The confidence is the percentage of channels that agree.
+        uint32_t wet;
+        uint32_t run;
+        uint32_t faults;
+        uint8_t confidence;
+        uint8_t waterline;
     } level;
 
     struct {
@@ -84,10 +266,19 @@ typedef struct {
     state_sensor_t sensors[NUM_SENSORS];
 } state_t;
 
-void reset();
+int reset();
 void init();
-void enable();
-void store();
-void load();
-void calibrate();
-void zero();
+int enable();
+int store();
+int load();
+int calibrate();
+int zero();
+int sample();
+void completeCommand(uint8_t command, int result);
+void finishCommand(uint8_t command, int result, bool detecting);
+void startSampling();
+void trackChange(uint16_t last, uint16_t value, uint16_t offset);
+void adaptInterval();
+void calibrateChannel(unsigned i, unsigned j, uint16_t last);
+void updateChannel(unsigned i, unsigned j, bool sampled);
+void updateState();
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "water_sensor_internals.h"
+
+#define SAMPLER_SLOTS (WATER_SENSOR_CHANNELS + 1)
+#define SAMPLER_SLOT_TEMPERATURE WATER_SENSOR_CHANNELS
+
+typedef struct {
+    uint32_t sum[SAMPLER_SLOTS];
+    uint32_t squares[SAMPLER_SLOTS];
+    uint16_t count[SAMPLER_SLOTS];
+} sampler_result_t;
+
+void samplerBegin();
+void samplerStart(const uint16_t samples[SAMPLER_SLOTS]);
+bool samplerIsBusy();
+// Returns the result once sampling is done, or NULL otherwise. The result
+// stays valid until sampling is started again.
+const sampler_result_t *samplerRead();
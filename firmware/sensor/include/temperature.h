@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+// Convert a temperature sensor reading to centi-degrees Celsius. The reading
+// is an ADC value, where the ADC reference is given in millivolts.
+int16_t temperatureConvert(uint16_t value, uint16_t reference);
@@ -5,9 +5,22 @@
 #include <SoftWire.h>
 
 #include "water_sensor_internals.h"
+#include "wire_master.h"
 
 #define WATER_SENSOR_OK 0
 #define WATER_SENSOR_ERR_I2C -1
+#define WATER_SENSOR_ERR_FAILED -2
+#define WATER_SENSOR_ERR_TIMEOUT -3
+#define WATER_SENSOR_ERR_BUSY -4
+
+#define WATER_SENSOR_WAIT_INTERVAL 5
+#define WATER_SENSOR_WAIT_TIMEOUT 1000
+
+// Storing the configuration writes the EEPROM of the sensor and then of its
+// children, which takes a few milliseconds per changed byte.
+#define WATER_SENSOR_STORE_TIMEOUT 5000
+
+#define WATER_SENSOR_STATE_RETRIES 3
 
 typedef struct {
     uint8_t id;
@@ -16,12 +29,16 @@ typedef struct {
     bool enabled;
     uint8_t errors;
     uint8_t context;
+    uint16_t sequence;
+    uint16_t interval;
+    uint16_t changes;
 } water_sensor_info_t;
 
 typedef struct {
     int16_t value;
     int8_t channel;
     bool valid;
+    int32_t interpolated;
 } water_sensor_level_t;
 
 typedef struct {
@@ -44,24 +61,75 @@ typedef struct {
     bool valid;
 } water_sensor_temperature_raw_t;
 
+typedef struct {
+    water_sensor_level_raw_t level[WATER_SENSOR_CHANNELS];
+    water_sensor_temperature_raw_t temperature;
+    uint8_t latch;
+} water_sensor_snapshot_t;
+
+typedef struct {
+    uint32_t channels;
+    uint8_t confidence;
+} water_sensor_faults_t;
+
+typedef struct {
+    water_sensor_info_t info;
+    water_sensor_level_t level;
+    water_sensor_temperature_t temperature;
+    uint32_t wet;
+    water_sensor_snapshot_t snapshots[WATER_SENSOR_SENSORS];
+    water_sensor_faults_t faults;
+} water_sensor_state_t;
+
+typedef struct {
+    uint8_t commands[WATER_SENSOR_COMMANDS];
+    uint8_t write;
+} water_sensor_status_t;
+
+typedef struct {
+    uint8_t count;
+    int32_t mean;
+    uint32_t variance;
+} water_sensor_statistics_t;
+
 typedef struct {
     int16_t default_level;
+    uint16_t min_interval;
+    uint16_t max_interval;
+    uint8_t noise_target;
+    uint16_t sample_budget;
+    int16_t compensation_temperature;
+    uint8_t interpolation;
 } water_sensor_config_t;
 
 typedef struct {
     bool enabled;
     uint16_t samples;
+    uint8_t filter;
     uint8_t alpha;
+    uint8_t period;
+    uint8_t resolution;
     uint16_t offset;
     int16_t level;
+    uint8_t compensation;
+    int16_t coefficient;
+    uint8_t calibration;
+    uint16_t dry;
+    uint16_t wet;
+    uint16_t hysteresis;
+    uint8_t debounce;
 } water_sensor_level_config_t;
 
 typedef struct {
     bool enabled;
+    uint8_t filter;
     uint8_t alpha;
+    uint8_t period;
     uint16_t reference;
 } water_sensor_temperature_config_t;
 
+typedef void (*water_sensor_snapshot_callback_t)(int result, const water_sensor_snapshot_t *snapshot, void *arg);
+
 class WaterSensor {
 public:
     WaterSensor();
@@ -83,27 +151,57 @@ public:
     int store();
     int calibrate();
     int zero();
+    int sample();
+    int check(uint8_t cmd);
+
+    static int broadcast(SoftWire *wire, uint8_t cmd);
 
     int readInfo(water_sensor_info_t *out);
     int readLevel(water_sensor_level_t *out);
     int readTemperature(water_sensor_temperature_t *out);
+    int readWet(uint32_t *out);
+    int readFaults(water_sensor_faults_t *out);
     int readLevelRaw(uint8_t channel, water_sensor_level_raw_t *out);
     int readTemperatureRaw(uint8_t channel, water_sensor_temperature_raw_t *out);
+    int readSnapshot(uint8_t sensor, water_sensor_snapshot_t *out);
+    int readSnapshotAsync(WireMaster *master, uint8_t sensor, water_sensor_snapshot_callback_t callback, void *arg);
+    int readLatched(water_sensor_snapshot_t *out);
+    int readLatchedAsync(WireMaster *master, water_sensor_snapshot_callback_t callback, void *arg);
+    int readState(water_sensor_state_t *out);
+    int readStatus(water_sensor_status_t *out);
+    int readLevelStatistics(uint8_t channel, water_sensor_statistics_t *out);
+    int readTemperatureStatistics(uint8_t channel, water_sensor_statistics_t *out);
     int readConfig(water_sensor_config_t *out);
     int writeConfig(const water_sensor_config_t *in);
     int readLevelConfig(uint8_t channel, water_sensor_level_config_t *out);
     int writeLevelConfig(uint8_t channel, const water_sensor_level_config_t *in);
     int readTemperatureConfig(uint8_t channel, water_sensor_temperature_config_t *out);
     int writeTemperatureConfig(uint8_t channel, const water_sensor_temperature_config_t *in);
+    int readRegister(uint16_t reg, uint8_t *data, size_t length);
+    int writeRegister(uint16_t reg, const uint8_t *data, size_t length);
 
 private:
     SoftWire *_wire;
 
     uint8_t _address;
 
+    /* only one asynchronous read can be outstanding, for all sensors */
+    static wire_master_transfer_t _transfer;
+    static uint8_t _reg[2];
+    static water_sensor_snapshot_callback_t _callback;
+    static void *_arg;
+    static bool _busy;
+
     int cmd(uint8_t cmd);
-    int read_reg(uint8_t reg, uint8_t *data, size_t length);
-    int read_reg16(uint16_t reg, uint8_t *data, size_t length);
-    int write_reg(uint8_t reg, const uint8_t *data, size_t length);
-    int write_reg16(uint16_t reg, const uint8_t *data, size_t length);
+    int wait(uint8_t cmd);
+    int check_status(uint8_t index);
+    int wait_status(uint8_t index, unsigned long timeout = WATER_SENSOR_WAIT_TIMEOUT);
+    int read_state(water_sensor_state_t *out);
+    int read_snapshot(uint16_t reg, water_sensor_snapshot_t *out);
+    int read_snapshot_async(WireMaster *master, uint16_t reg, water_sensor_snapshot_callback_t callback, void *arg);
+    int read_statistics(uint16_t reg, water_sensor_statistics_t *out);
+
+    static void on_snapshot(int result, const uint8_t *data, size_t length, void *arg);
+    int read_reg(uint16_t reg, uint8_t *data, size_t length);
+    int write_reg(uint16_t reg, const uint8_t *data, size_t length);
 };
\ No newline at end of file
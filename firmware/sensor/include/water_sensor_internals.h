@@ -28,52 +28,340 @@ extern "C" {
  */
 #define WATER_SENSOR_I2C_ADDRESS    (0x70)
 
+/**
+ * @brief General call address, to which all child sensors respond
+ */
+#define WATER_SENSOR_I2C_GENERAL_CALL   (0x00)
+
 /**
  * @brief Water sensor sensor identifier
  */
 #define WATER_SENSOR_ID (0xBA)
 
+/**
+ * @brief Number of level channels per sensor board
+ */
+#define WATER_SENSOR_CHANNELS   (4U)
+
+/**
+ * @brief Maximum number of sensor boards in one chain
+ */
+#define WATER_SENSOR_SENSORS    (8U)
+
 /**
  * @name Water sensor commands.
+ *
+ * Child sensors also receive commands on the general call address, where a
+ * second byte of 0x00 is not allowed, 0x04 and 0x06 are reserved for
+ * programming addresses, and odd bytes are hardware general calls. Therefore,
+ * the commands are even and start at 0x10.
  * @{
  */
-#define WATER_SENSOR_RESET      (0x00)
-#define WATER_SENSOR_ENABLE     (0x01)
-#define WATER_SENSOR_LOAD       (0x02)
-#define WATER_SENSOR_STORE      (0x03)
-#define WATER_SENSOR_CALIBRATE  (0x04)
-#define WATER_SENSOR_ZERO       (0x05)
+#define WATER_SENSOR_RESET      (0x10)
+#define WATER_SENSOR_ENABLE     (0x12)
+#define WATER_SENSOR_LOAD       (0x14)
+#define WATER_SENSOR_STORE      (0x16)
+#define WATER_SENSOR_CALIBRATE  (0x18)
+#define WATER_SENSOR_ZERO       (0x1A)
+#define WATER_SENSOR_SAMPLE     (0x1C)
 /** @} */
 
 /**
- * @name Water sensor registers.
+ * @brief Number of water sensor commands
+ */
+#define WATER_SENSOR_COMMANDS   (7U)
+
+/**
+ * @brief Index of a command in the status register
+ */
+#define WATER_SENSOR_COMMAND_INDEX(cmd) (((cmd) - WATER_SENSOR_RESET) >> 1)
+
+/**
+ * @brief Index of the status of the last register write in the status
+ *        register, which follows the status of the commands
+ */
+#define WATER_SENSOR_STATUS_WRITE   (WATER_SENSOR_COMMANDS)
+
+/**
+ * @name Water sensor command status.
+ *
+ * Commands are queued by the sensor and executed in the background. The
+ * status register holds the status of the last execution of every command,
+ * at the index of the command (see WATER_SENSOR_COMMAND_INDEX). The status is
+ * in the lower bits (see WATER_SENSOR_STATUS_MASK). The upper bits count how
+ * often the command (or a write) was received, modulo 64, so that a host that
+ * broadcasts a command can tell its execution apart from a previous one, and
+ * tell which sensors missed it.
+ * @{
+ */
+#define WATER_SENSOR_STATUS_IDLE    (0x00)
+#define WATER_SENSOR_STATUS_PENDING (0x01)
+#define WATER_SENSOR_STATUS_DONE    (0x02)
+#define WATER_SENSOR_STATUS_FAILED  (0x03)
+#define WATER_SENSOR_STATUS_MASK    (0x03)
+#define WATER_SENSOR_STATUS_COUNT_SHIFT (2U)
+/** @} */
+
+/**
+ * @name Water sensor filters.
+ *
+ * The samples of every channel are smoothed by the configured filter. The
+ * meaning of the filter parameter (alpha) depends on the filter:
+ *
+ * - EMA: exponential moving average, where a new sample weighs 1 / 2^alpha.
+ * - AVERAGE: moving average of the last 2^alpha samples.
+ * - MEDIAN: median of the last alpha samples, which rejects spikes.
+ *
+ * The number of samples is limited to WATER_SENSOR_FILTER_WINDOW.
+ * @{
+ */
+#define WATER_SENSOR_FILTER_EMA     (0x00)
+#define WATER_SENSOR_FILTER_AVERAGE (0x01)
+#define WATER_SENSOR_FILTER_MEDIAN  (0x02)
+/** @} */
+
+/**
+ * @brief Maximum number of samples held by a filter
+ */
+#define WATER_SENSOR_FILTER_WINDOW  (8U)
+
+/**
+ * @brief Maximum number of samples of a level channel per interval
+ *
+ * The number of samples is a 16-bit field of the level config register, but
+ * larger values are limited to this maximum.
+ */
+#define WATER_SENSOR_SAMPLES_MAX    (255U)
+
+/**
+ * @brief Maximum number of extra bits of resolution of a level channel
+ *
+ * A level channel with a resolution of N extra bits reports the average of
+ * its samples multiplied by 2^N. Oversampling adds resolution when there are
+ * at least 4^N samples, and there is some noise. The offset, calibration
+ * baselines and hysteresis of the channel are in the same scale as its values.
+ * When the resolution changes, those that the same write leaves unchanged are
+ * rescaled by the sensor. The maximum is the largest resolution for which 4^N
+ * does not exceed WATER_SENSOR_SAMPLES_MAX.
+ */
+#define WATER_SENSOR_RESOLUTION_MAX (3U)
+
+/**
+ * @name Water sensor temperature compensation modes.
+ *
+ * The values of a level channel can be compensated for the temperature of its
+ * sensor board, as value - (coefficient * (temperature - reference)) / 4096.
+ * The temperature is in centi-degrees, and the reference temperature is part
+ * of the config register. The coefficient is either configured, or learned
+ * from the values and temperatures while the channel is dry. Every sensor
+ * compensates its own channels, with its own temperature, so the values that
+ * a child reports to the parent are compensated already. The coefficient that
+ * a child learned is read back through the parent.
+ * @{
+ */
+#define WATER_SENSOR_COMPENSATION_OFF   (0x00)
+#define WATER_SENSOR_COMPENSATION_FIXED (0x01)
+#define WATER_SENSOR_COMPENSATION_LEARN (0x02)
+/** @} */
+
+/**
+ * @name Water sensor calibration modes.
+ *
+ * In automatic mode, the sensor keeps a dry and a wet baseline of a level
+ * channel, which follow the values below and above its offset. A baseline
+ * follows new extremes quickly, and drifts slowly otherwise. The offset moves
+ * gradually to one third between the dry and the wet baseline, as soon as
+ * they are far enough apart. In frozen mode, the baselines and the offset are
+ * kept as they are. A baseline of zero is unknown, and is learned again.
+ * The parent calibrates the channels of the children, because it determines
+ * the level with the offsets. A child never calibrates the channels that the
+ * parent forwards the configuration of.
+ * @{
+ */
+#define WATER_SENSOR_CALIBRATION_OFF    (0x00)
+#define WATER_SENSOR_CALIBRATION_AUTO   (0x01)
+#define WATER_SENSOR_CALIBRATION_FROZEN (0x02)
+/** @} */
+
+/**
+ * @brief Level channel hysteresis and debounce
+ *
+ * A dry level channel turns wet when its value exceeds its offset plus its
+ * hysteresis, and a wet channel turns dry when its value drops to its offset
+ * minus its hysteresis. With a debounce of N, a channel only changes sides
+ * after N consecutive samples on the other side. Both are configured per
+ * channel, and a value of zero disables them.
+ */
+
+/**
+ * @name Water sensor interpolation modes.
+ *
+ * The level register holds the level of the level channel, and the level as
+ * a fixed point number with eight fractional bits. Without interpolation, the
+ * latter is just the level. With interpolation, the dry channel right above
+ * the water is used to interpolate between the level and the level of that
+ * channel, by how far its value is between its dry baseline and its offset.
+ * This requires calibrated dry baselines.
  * @{
  */
-#define WATER_SENSOR_READ_INFO                  (0xA0)
-#define WATER_SENSOR_READ_LEVEL                 (0xA1)
-#define WATER_SENSOR_READ_TEMPERATURE           (0xA2)
-#define WATER_SENSOR_READ_LEVEL_RAW             (0xA3)
-#define WATER_SENSOR_READ_TEMPERATURE_RAW       (0xA4)
-#define WATER_SENSOR_READ_CONFIG                (0xA5)
-#define WATER_SENSOR_WRITE_CONFIG               (0xA6)
-#define WATER_SENSOR_READ_LEVEL_CONFIG          (0xA7)
-#define WATER_SENSOR_WRITE_LEVEL_CONFIG         (0xA8)
-#define WATER_SENSOR_READ_TEMPERATURE_CONFIG    (0xA9)
-#define WATER_SENSOR_WRITE_TEMPERATURE_CONFIG   (0xAA)
+#define WATER_SENSOR_INTERPOLATION_OFF  (0x00)
+#define WATER_SENSOR_INTERPOLATION_ON   (0x01)
 /** @} */
 
+/**
+ * @brief Number of values over which the statistics of a channel are kept
+ */
+#define WATER_SENSOR_STATISTICS_WINDOW  (64U)
+
 /**
  * @name Water sensor register sizes.
  * @{
  */
-#define WATER_SENSOR_INFO_SIZE                  (6U)
-#define WATER_SENSOR_LEVEL_SIZE                 (4U)
+#define WATER_SENSOR_INFO_SIZE                  (12U)
+#define WATER_SENSOR_LEVEL_SIZE                 (8U)
 #define WATER_SENSOR_TEMPERATURE_SIZE           (4U)
-#define WATER_SENSOR_LEVEL_RAW_SIZE             (7U)
-#define WATER_SENSOR_TEMPERATURE_RAW_SIZE       (7U)
-#define WATER_SENSOR_CONFIG_SIZE                (2U)
-#define WATER_SENSOR_LEVEL_CONFIG_SIZE          (8U)
-#define WATER_SENSOR_TEMPERATURE_CONFIG_SIZE    (4U)
+#define WATER_SENSOR_WET_SIZE                   (4U)
+#define WATER_SENSOR_SNAPSHOT_SIZE              (31U)
+#define WATER_SENSOR_FAULTS_SIZE                (5U)
+#define WATER_SENSOR_STATUS_SIZE                (WATER_SENSOR_COMMANDS + 1U)
+#define WATER_SENSOR_STATISTICS_SIZE            (9U)
+#define WATER_SENSOR_CONFIG_SIZE                (12U)
+#define WATER_SENSOR_LEVEL_CONFIG_SIZE          (22U)
+#define WATER_SENSOR_TEMPERATURE_CONFIG_SIZE    (6U)
+/** @} */
+
+/**
+ * @brief Size of a register, which is its data followed by a checksum
+ */
+#define WATER_SENSOR_REG_STRIDE(size)   ((size) + 1U)
+
+/**
+ * @name Water sensor registers.
+ *
+ * The registers form one flat address space. Every register consists of its
+ * data followed by a checksum. A read starts with writing the 16-bit register
+ * address, after which the sensor returns the bytes from that address on. The
+ * address auto-increments, so consecutive registers can be read at once, up
+ * to WATER_SENSOR_TRANSFER_SIZE bytes at a time, except for the statistics
+ * and configuration registers (see below). A write consists of the
+ * 16-bit register address, followed by the data and checksum of exactly one
+ * register. Only the configuration registers are writable. Writes are applied
+ * in the background, and the status register holds the status of the last
+ * write (see WATER_SENSOR_STATUS_WRITE). A write fails if its checksum is
+ * invalid, if it does not cover exactly one register, if its values are out
+ * of range, or if the previous write is still pending, so a host should wait
+ * for every write to complete.
+ *
+ * The state (the info, level, temperature, wet, snapshot and faults
+ * registers) is published at once, and every register is updated at once.
+ * The info register holds a sequence number that increments with every
+ * published state. While a state is published, the info register reads with
+ * an invalid checksum, and it is updated last. A transfer that contains a
+ * valid info register therefore never contains parts of different states,
+ * and neither do the transfers in between two reads of the info register
+ * with the same sequence number. A host should read the info register again
+ * if its checksum is invalid. The minimum and maximum in the snapshots are
+ * those of the published values.
+ *
+ * The sensor samples at an interval between the configured minimum and
+ * maximum. The minimum must be at least one, and not exceed the maximum. It
+ * shortens the interval when the channels change quickly, and stretches it
+ * while they are stable. The info register holds the current interval, in
+ * milliseconds. Every channel has a period, which is the number
+ * of intervals between two samples of that channel, so that slowly changing
+ * signals (e.g. the temperature) are sampled less often.
+ *
+ * If a noise target is configured, the number of samples of every level
+ * channel adapts to the noise of that channel, up to its configured number of
+ * samples (at most WATER_SENSOR_SAMPLES_MAX). The target is the noise of the
+ * averaged value, in 1/16 counts. The sample budget limits the total number of
+ * samples per interval.
+ *
+ * The info register also holds a change counter, which increments whenever
+ * the level, the temperature or the wet channels change. A host only has to
+ * read these registers again when the counter changed.
+ *
+ * The wet register holds one bit per level channel, which is set when the
+ * value of that channel exceeds its offset. Bit N is channel N, and the
+ * register is a 32-bit number, most significant byte first.
+ *
+ * The level is determined by the waterline that disagrees with the fewest
+ * channels, so that a single stuck or disconnected channel does not affect
+ * it. The faults register holds the channels that disagree with the
+ * waterline, in the same format as the wet register, followed by the
+ * percentage of channels that agree with it (the confidence). Channels
+ * without a valid value (e.g. of a child that cannot be read) are left out,
+ * and make the level invalid until they are valid again.
+ *
+ * The latched register holds a snapshot of the local channels, taken when the
+ * sample command was executed. Child sensors also accept the sample command
+ * on the general call address, so that all of them sample at the same time.
+ *
+ * The statistics registers hold the number of values, the running mean and
+ * the running variance of every channel. The mean and variance are fixed point
+ * numbers with eight fractional bits. The mean is a moving average over
+ * WATER_SENSOR_STATISTICS_WINDOW values, that starts at the first value. The
+ * variance covers (approximately) the last WATER_SENSOR_STATISTICS_WINDOW
+ * values. Unlike the minimum and maximum, they are not cleared by the zero
+ * command.
+ *
+ * The statistics and configuration registers are prepared when the host
+ * selects them, one register at a time. A read returns the selected register
+ * from the selected address up to its end, and zeros after it. Until the
+ * register is prepared, it reads as zeros, which is an invalid checksum, so a
+ * host should read it again until the checksum is valid.
+ *
+ * Every child holds the sampling configuration and statistics of its own
+ * channels. The parent prepares the level configuration, temperature
+ * configuration and statistics registers of the children by reading them from
+ * the children, which takes longer. The parent forwards writes of these
+ * registers to the children, and
+ * writes of the configuration register to all of them. The load and store
+ * commands apply to the children as well.
+ * @{
+ */
+#define WATER_SENSOR_REG_INFO                       (0x0000)
+#define WATER_SENSOR_REG_LEVEL                      (WATER_SENSOR_REG_INFO + WATER_SENSOR_REG_STRIDE(WATER_SENSOR_INFO_SIZE))
+#define WATER_SENSOR_REG_TEMPERATURE                (WATER_SENSOR_REG_LEVEL + WATER_SENSOR_REG_STRIDE(WATER_SENSOR_LEVEL_SIZE))
+#define WATER_SENSOR_REG_WET                        (WATER_SENSOR_REG_TEMPERATURE + WATER_SENSOR_REG_STRIDE(WATER_SENSOR_TEMPERATURE_SIZE))
+#define WATER_SENSOR_REG_SNAPSHOT(sensor)           (WATER_SENSOR_REG_WET + WATER_SENSOR_REG_STRIDE(WATER_SENSOR_WET_SIZE) + ((sensor) * WATER_SENSOR_REG_STRIDE(WATER_SENSOR_SNAPSHOT_SIZE)))
+#define WATER_SENSOR_REG_FAULTS                     (WATER_SENSOR_REG_SNAPSHOT(WATER_SENSOR_SENSORS))
+#define WATER_SENSOR_REG_STATUS                     (WATER_SENSOR_REG_FAULTS + WATER_SENSOR_REG_STRIDE(WATER_SENSOR_FAULTS_SIZE))
+#define WATER_SENSOR_REG_LATCHED                    (WATER_SENSOR_REG_STATUS + WATER_SENSOR_REG_STRIDE(WATER_SENSOR_STATUS_SIZE))
+#define WATER_SENSOR_REG_LEVEL_STATISTICS(channel) (WATER_SENSOR_REG_LATCHED + WATER_SENSOR_REG_STRIDE(WATER_SENSOR_SNAPSHOT_SIZE) + ((channel) * WATER_SENSOR_REG_STRIDE(WATER_SENSOR_STATISTICS_SIZE)))
+#define WATER_SENSOR_REG_TEMPERATURE_STATISTICS(sensor) (WATER_SENSOR_REG_LEVEL_STATISTICS(WATER_SENSOR_SENSORS * WATER_SENSOR_CHANNELS) + ((sensor) * WATER_SENSOR_REG_STRIDE(WATER_SENSOR_STATISTICS_SIZE)))
+#define WATER_SENSOR_REG_CONFIG                     (WATER_SENSOR_REG_TEMPERATURE_STATISTICS(WATER_SENSOR_SENSORS))
+#define WATER_SENSOR_REG_LEVEL_CONFIG(channel)      (WATER_SENSOR_REG_CONFIG + WATER_SENSOR_REG_STRIDE(WATER_SENSOR_CONFIG_SIZE) + ((channel) * WATER_SENSOR_REG_STRIDE(WATER_SENSOR_LEVEL_CONFIG_SIZE)))
+#define WATER_SENSOR_REG_TEMPERATURE_CONFIG(sensor) (WATER_SENSOR_REG_LEVEL_CONFIG(WATER_SENSOR_SENSORS * WATER_SENSOR_CHANNELS) + ((sensor) * WATER_SENSOR_REG_STRIDE(WATER_SENSOR_TEMPERATURE_CONFIG_SIZE)))
+#define WATER_SENSOR_REG_SIZE                       (WATER_SENSOR_REG_TEMPERATURE_CONFIG(WATER_SENSOR_SENSORS))
+/** @} */
+
+/**
+ * @brief Maximum number of bytes per transfer, including checksums
+ */
+#define WATER_SENSOR_TRANSFER_SIZE  (32U)
+
+/**
+ * @name Water sensor snapshot layout.
+ *
+ * A snapshot contains the raw value, min and max of all level channels of
+ * one sensor board, followed by the temperature channel and one byte with the
+ * valid flags. Including its checksum, it fits in one transfer. In the
+ * latched register, the upper bits of the valid flags hold a counter that
+ * increments with every sample command, so that a new sample can be told
+ * apart from the previous one. The reset command clears the counter.
+ *
+ * The counter wraps after eight sample commands. A host should compare it
+ * with the value it expects (one more for every sample command it sent since
+ * it last read the counter), instead of only checking that it changed, and
+ * read it at least once every eight sample commands.
+ * @{
+ */
+#define WATER_SENSOR_SNAPSHOT_TEMPERATURE       (WATER_SENSOR_CHANNELS * 6U)
+#define WATER_SENSOR_SNAPSHOT_VALID             (WATER_SENSOR_SNAPSHOT_TEMPERATURE + 6U)
+#define WATER_SENSOR_SNAPSHOT_VALID_TEMPERATURE (WATER_SENSOR_CHANNELS)
+#define WATER_SENSOR_SNAPSHOT_LATCH_SHIFT       (5U)
+#define WATER_SENSOR_SNAPSHOT_LATCH_MASK        (0x07)
 /** @} */
 
 /**
@@ -87,6 +375,11 @@ extern "C" {
 #define WATER_SENSOR_INFO_ERRORS_ZERO   (4U)
 /** @} */
 
+/**
+ * @brief Error context when an error concerns all child sensors
+ */
+#define WATER_SENSOR_INFO_CONTEXT_ALL   (0xff)
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <SoftWire.h>
+
+#define WIRE_MASTER_OK 0
+#define WIRE_MASTER_ERR_FULL -1
+
+// One slot is kept free, so three transfers can be queued: the sample command,
+// the read of a child and the transfer of the operation on the children.
+#define WIRE_MASTER_QUEUE_SIZE 4
+#define WIRE_MASTER_BUFFER_SIZE 32
+
+typedef void (*wire_master_callback_t)(int result, const uint8_t *data, size_t length, void *arg);
+
+// A transfer writes the given bytes (if any) and then reads the given number
+// of bytes (if any), with a stop condition in between. The transfer is owned
+// by the caller, and must not be modified until the callback is invoked.
+typedef struct {
+    uint8_t address;
+    const uint8_t *writeData;
+    uint8_t writeLength;
+    uint8_t readLength;
+    wire_master_callback_t callback;
+    void *arg;
+} wire_master_transfer_t;
+
+// Non-blocking I2C master on top of SoftWire. Transfers are queued and
+// executed one bus operation (a start condition or a byte) per call to
+// poll(), so that the caller can do other work in between. The result of a
+// transfer is zero, or the SoftWire result of the operation that failed.
+class WireMaster {
+public:
+    WireMaster(SoftWire *wire);
+
+    int submit(wire_master_transfer_t *transfer);
+    void poll();
+    void flush();
+
+    inline bool isIdle()
+    {
+        return _state == STATE_IDLE && _head == _tail;
+    }
+
+private:
+    enum state_t {
+        STATE_IDLE,
+        STATE_WRITE,
+        STATE_READ_START,
+        STATE_READ,
+    };
+
+    SoftWire *_wire;
+
+    wire_master_transfer_t *_queue[WIRE_MASTER_QUEUE_SIZE];
+    uint8_t _head;
+    uint8_t _tail;
+
+    wire_master_transfer_t *_current;
+    state_t _state;
+    uint8_t _index;
+    uint8_t _buffer[WIRE_MASTER_BUFFER_SIZE];
+
+    void start();
+    void finish(int result);
+};
@@ -0,0 +1,117 @@
+#include "filter.h"
+
+// Shift of the exponential moving average, limited so that the accumulator
+// cannot overflow.
+static uint8_t _shift(uint8_t alpha)
+{
+    return alpha > 15 ? 15 : alpha;
+}
+
+// Number of samples in the window, for the given filter. For the moving
+// average, it is a power of two.
+static uint8_t _windowSize(uint8_t type, uint8_t alpha)
+{
+    if (type == WATER_SENSOR_FILTER_AVERAGE) {
+        return (alpha < 8 && (1U << alpha) < FILTER_WINDOW) ? (1U << alpha) : FILTER_WINDOW;
+    }
+    else if (type == WATER_SENSOR_FILTER_MEDIAN) {
+        return alpha == 0 ? 1 : (alpha < FILTER_WINDOW ? alpha : FILTER_WINDOW);
+    }
+
+    return 1;
+}
+
+static void _prime(filter_t *filter, uint8_t type, uint8_t alpha, int16_t value)
+{
+    uint8_t size = _windowSize(type, alpha);
+
+    for (unsigned i = 0; i < size; i++) {
+        filter->window[i] = value;
+    }
+
+    if (type == WATER_SENSOR_FILTER_AVERAGE) {
+        filter->accumulator = (int32_t)value * size;
+    }
+    else {
+        filter->accumulator = (int32_t)value << _shift(alpha);
+    }
+
+    filter->index = 0;
+    filter->type = type;
+    filter->alpha = alpha;
+    filter->primed = true;
+}
+
+static int16_t _ema(filter_t *filter, int16_t value)
+{
+    // The accumulator holds the average scaled by 2^alpha, so that no
+    // precision is lost when shifting.
+    uint8_t shift = _shift(filter->alpha);
+
+    filter->accumulator += value - (filter->accumulator >> shift);
+
+    return filter->accumulator >> shift;
+}
+
+static int16_t _average(filter_t *filter, int16_t value)
+{
+    uint8_t size = _windowSize(filter->type, filter->alpha);
+
+    // Keep a running sum, by replacing the oldest sample.
+    filter->accumulator += value - filter->window[filter->index];
+    filter->window[filter->index] = value;
+    filter->index = (filter->index + 1) % size;
+
+    return filter->accumulator >> __builtin_ctz(size);
+}
+
+static int16_t _median(filter_t *filter, int16_t value)
+{
+    uint8_t size = _windowSize(filter->type, filter->alpha);
+    int16_t sorted[FILTER_WINDOW];
+
+    filter->window[filter->index] = value;
+    filter->index = (filter->index + 1) % size;
+
+    // Insertion sort, which is fast enough for a few samples.
+    for (unsigned i = 0; i < size; i++) {
+        int16_t sample = filter->window[i];
+        unsigned j = i;
+
+        while (j > 0 && sorted[j - 1] > sample) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+
+        sorted[j] = sample;
+    }
+
+    return sorted[size / 2];
+}
+
+void filterReset(filter_t *filter)
+{
+    filter->primed = false;
+}
+
+int16_t filterApply(filter_t *filter, uint8_t type, uint8_t alpha, int16_t value)
+{
+    if (!filter->primed || filter->type != type || filter->alpha != alpha) {
+        _prime(filter, type, alpha, value);
+    }
+
+    switch (type) {
+        case WATER_SENSOR_FILTER_AVERAGE:
+        {
+            return _average(filter, value);
+        }
+        case WATER_SENSOR_FILTER_MEDIAN:
+        {
+            return _median(filter, value);
+        }
+        default:
+        {
+            return _ema(filter, value);
+        }
+    }
+}
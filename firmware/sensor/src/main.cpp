@@ -1,852 +1,2691 @@
+#include <stddef.h>
 #include <stdint.h>
 
-#include <ADCTouch.h>
 #include <Arduino.h>
 #include <EEPROM.h>
 #include <HardWire.h>
 #include <SoftWire.h>
+#include <util/atomic.h>
 
+#include "filter.h"
 #include "main.h"
+#include "sampler.h"
+#include "temperature.h"
 #include "water_sensor.h"
+#include "wire_master.h"
 
 static info_t info;
 static config_t config;
 static state_t state;
 
-static WaterSensor waterSensor[NUM_SENSORS];
+// Filters of the local channels, indexed by sampler slot.
+static filter_t filters[SAMPLER_SLOTS];
+
+// Number of intervals until the next sample of the local channels, indexed by
+// sampler slot.
+static uint8_t countdown[SAMPLER_SLOTS];
+
+// Number of samples of the local level channels, when adapting to the noise.
+static uint8_t adaptiveSamples[NUM_CHANNELS];
+
+// Running regression of the local level channels on the temperature, from
+// which the temperature coefficients are learned. The means have eight
+// fractional bits.
+static struct {
+    int32_t temperature;
+    int32_t variance;
+    int32_t value[NUM_CHANNELS];
+    int32_t covariance[NUM_CHANNELS];
+    int32_t deviation;
+    uint8_t primed;
+} regression;
+
+// Driver of the children, which reads one child at a time.
+static WaterSensor childSensor;
 
 static SoftWire Wire2(PIN_MASTER_SDA, PIN_MASTER_SCL);
+static WireMaster wireMaster(&Wire2);
+
+// Progress of reading the children. Every round starts with sampling all
+// sensors at the same time, after which the latched samples of the children
+// are read one by one, UPDATE_SLICE per slot.
+static struct {
+    uint8_t child;
+    uint8_t attempts;
+    uint8_t slice;
+    bool active;
+    bool busy;
+} polling;
+
+void sampledChildren(int result, const uint8_t *data, size_t length, void *arg);
+
+static const uint8_t sampleCommand = WATER_SENSOR_SAMPLE;
+static wire_master_transfer_t sampleTransfer = { WATER_SENSOR_I2C_GENERAL_CALL, &sampleCommand, 1, 0, sampledChildren, NULL };
+
+// Operation on the children that runs in the background (see
+// OPERATION_IDLE). Its transfers are queued on the master one at a time. The
+// next transfer is queued from the callback of the previous one, or by
+// pollChildren() when the operation waits before polling again.
+static struct {
+    uint8_t phase;
+    uint8_t command;
+    uint8_t index;
+    uint8_t child;
+    uint8_t pending;
+    uint8_t length;
+    uint8_t header[2];
+    uint8_t counts[NUM_SENSORS - 1];
+    uint16_t address;
+    int result;
+    bool busy;
+    bool waiting;
+    unsigned long start;
+    unsigned long time;
+    wire_master_transfer_t transfer;
+} operation;
+
+// Counter of latched samples.
+static uint8_t latch;
 
-static char swTxBuffer[32];
-static char swRxBuffer[32];
+// Set when the local sensors are sampled for the sample command, until the
+// sample is latched.
+static bool latching;
 
 static AsyncDelay readTimer;
 static AsyncDelay updateTimer;
+static AsyncDelay slotTimer;
+
+// Registers that are kept serialized, so that the I2C handler only copies
+// them. The other registers are prepared when the host selects them (see
+// selected).
+static uint8_t statusRegister[WATER_SENSOR_REG_STRIDE(WATER_SENSOR_STATUS_SIZE)];
+static uint8_t latchedRegister[WATER_SENSOR_REG_STRIDE(WATER_SENSOR_SNAPSHOT_SIZE)];
+
+// The published state registers (the info, level, temperature, wet, snapshot
+// and faults registers). There is no room for a second copy, so the main loop
+// publishes them in place, one register at a time (see
+// publishStateRegisters()).
+static uint8_t stateRegisters[STATE_REGISTERS_SIZE];
+
+// Sequence number of the published state.
+static uint16_t sequence;
+
+// Statistics of the local channels, indexed by sampler slot. The statistics
+// of a child are kept by that child.
+static statistics_t statistics[SAMPLER_SLOTS];
+
+// Register written by the host, until the main loop applied it. The I2C
+// handler only writes it when no write is pending, and the main loop verifies
+// it. The register starts at WRITTEN_DATA, after room for the register
+// address, so that it can be forwarded to a child as is.
+#define WRITTEN_DATA 2
+
+static struct {
+    uint16_t address;
+    uint8_t length;
+    uint8_t buffer[WRITTEN_DATA + WATER_SENSOR_REG_STRIDE(WATER_SENSOR_LEVEL_CONFIG_SIZE)];
+    volatile bool pending;
+} written;
+
+// Statistics or configuration register that the host selected (see
+// SELECTED_IDLE), from the selected address up to the end of the register.
+// It is prepared by the main loop, and reads as invalid until then, so that
+// the host reads it again. The main loop only writes the buffer while the
+// register is pending.
+static struct {
+    uint16_t address;
+    volatile uint8_t status;
+    uint8_t length;
+    uint8_t buffer[WATER_SENSOR_REG_STRIDE(WATER_SENSOR_LEVEL_CONFIG_SIZE)];
+} selected;
+
+// Commands received by the I2C handler, until they are executed by the main
+// loop. The I2C handler is the only producer and the main loop the only
+// consumer, and both indices are a single byte, so no locking is needed.
+static struct {
+    uint8_t buffer[COMMAND_QUEUE_SIZE];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+} commands;
 
-// I2C response structure.
+// I2C transfer structure.
 static struct {
-    uint8_t buffer[32];
-    size_t length;
-    bool nack;
-} response;
+    uint16_t address;
+    uint8_t length;
+} transfer;
 
-static bool _read(size_t length)
+static uint8_t _checksum(const uint8_t *data, size_t length)
 {
     uint8_t checksum = 0xff;
 
     for (unsigned i = 0; i < length; i++) {
-        response.buffer[i] = Wire.read();
-        checksum ^= response.buffer[i];
+        checksum ^= data[i];
     }
 
-    return checksum == Wire.read();
+    return checksum;
 }
 
-void receiveEvent(int countToRead)
+static void _seal(uint8_t *buffer, size_t length)
 {
-    // Reset response, so that no stale date is read.
-    response.length = 0;
-    response.nack = false;
+    buffer[length] = _checksum(buffer, length);
+}
+
+static bool _isSealed(const uint8_t *buffer, size_t length)
+{
+    return buffer[length] == _checksum(buffer, length);
+}
 
-    // Read the command.
-    uint8_t data = Wire.read();
+// Copy a serialized register into the published state registers. The I2C
+// handler is held off while it is copied, so that it never reads a register
+// halfway, but only for as long as the copy takes.
+static void _publishRegister(uint16_t reg, const uint8_t *buffer, uint8_t size)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memcpy(&stateRegisters[reg], buffer, WATER_SENSOR_REG_STRIDE(size));
+    }
+}
 
-    // Serial.print("Parent data: ");
-    // Serial.println(data, HEX);
+// Minimum and maximum of a level channel, as published in the snapshot of its
+// sensor. Once they are reset, they read as reset until the snapshot is
+// published again.
+static void _getExtremes(unsigned i, unsigned j, uint16_t *low, uint16_t *high)
+{
+    const uint8_t *buffer = &stateRegisters[WATER_SENSOR_REG_SNAPSHOT(i) + (j * 6)];
 
-    switch (data) {
-        case WATER_SENSOR_RESET:
-        {
-            reset();
-            break;
+    if (state.zeroedChannels & ((uint32_t)1 << ((i * NUM_CHANNELS) + j))) {
+        *low = UINT16_MAX;
+        *high = 0;
+        return;
+    }
+
+    *low = (buffer[2] << 8) | buffer[3];
+    *high = (buffer[4] << 8) | buffer[5];
+}
+
+// Serialize the snapshot of a sensor, without its checksum. The minimum and
+// maximum are those of the published snapshot, extended with the values.
+static void _serializeSnapshot(uint8_t *buffer, unsigned i)
+{
+    const uint8_t *published = &stateRegisters[WATER_SENSOR_REG_SNAPSHOT(i) + WATER_SENSOR_SNAPSHOT_TEMPERATURE];
+    const state_sensor_t *sensor = &state.sensors[i];
+    uint8_t valid = 0;
+
+    for (unsigned j = 0; j < NUM_CHANNELS; j++) {
+        uint16_t value = sensor->adc[j].value;
+        uint16_t low;
+        uint16_t high;
+
+        _getExtremes(i, j, &low, &high);
+
+        if (sensor->adc[j].valid) {
+            low = min(low, value);
+            high = max(high, value);
+            valid |= 1 << j;
         }
-        case WATER_SENSOR_ENABLE:
-        {
-            enable();
-            break;
+
+        buffer[(j * 6) + 0] = (value & 0xff00) >> 8;
+        buffer[(j * 6) + 1] = (value & 0x00ff) >> 0;
+        buffer[(j * 6) + 2] = (low & 0xff00) >> 8;
+        buffer[(j * 6) + 3] = (low & 0x00ff) >> 0;
+        buffer[(j * 6) + 4] = (high & 0xff00) >> 8;
+        buffer[(j * 6) + 5] = (high & 0x00ff) >> 0;
+    }
+
+    int16_t value = sensor->temperature.value;
+    int16_t low = INT16_MAX;
+    int16_t high = INT16_MIN;
+
+    if (!(state.zeroedSensors & _BV(i))) {
+        low = (published[2] << 8) | published[3];
+        high = (published[4] << 8) | published[5];
+    }
+
+    if (sensor->temperature.valid) {
+        low = min(low, value);
+        high = max(high, value);
+        valid |= 1 << WATER_SENSOR_SNAPSHOT_VALID_TEMPERATURE;
+    }
+
+    buffer[WATER_SENSOR_SNAPSHOT_TEMPERATURE + 0] = (value & 0xff00) >> 8;
+    buffer[WATER_SENSOR_SNAPSHOT_TEMPERATURE + 1] = (value & 0x00ff) >> 0;
+    buffer[WATER_SENSOR_SNAPSHOT_TEMPERATURE + 2] = (low & 0xff00) >> 8;
+    buffer[WATER_SENSOR_SNAPSHOT_TEMPERATURE + 3] = (low & 0x00ff) >> 0;
+    buffer[WATER_SENSOR_SNAPSHOT_TEMPERATURE + 4] = (high & 0xff00) >> 8;
+    buffer[WATER_SENSOR_SNAPSHOT_TEMPERATURE + 5] = (high & 0x00ff) >> 0;
+
+    buffer[WATER_SENSOR_SNAPSHOT_VALID] = valid;
+}
+
+static void _serializeConfig(uint8_t *buffer)
+{
+    buffer[0] = (config.defaultLevel & 0xff00) >> 8;
+    buffer[1] = (config.defaultLevel & 0x00ff) >> 0;
+    buffer[2] = (config.minInterval & 0xff00) >> 8;
+    buffer[3] = (config.minInterval & 0x00ff) >> 0;
+    buffer[4] = (config.maxInterval & 0xff00) >> 8;
+    buffer[5] = (config.maxInterval & 0x00ff) >> 0;
+    buffer[6] = config.noiseTarget;
+    buffer[7] = (config.sampleBudget & 0xff00) >> 8;
+    buffer[8] = (config.sampleBudget & 0x00ff) >> 0;
+    buffer[9] = (config.compensationTemperature & 0xff00) >> 8;
+    buffer[10] = (config.compensationTemperature & 0x00ff) >> 0;
+    buffer[11] = config.interpolation;
+
+    _seal(buffer, WATER_SENSOR_CONFIG_SIZE);
+}
+
+static bool _parseConfig(const uint8_t *buffer)
+{
+    uint16_t minInterval = (buffer[2] << 8) | buffer[3];
+    uint16_t maxInterval = (buffer[4] << 8) | buffer[5];
+
+    // A zero interval would sample on every loop, and a minimum above the
+    // maximum would pin the interval.
+    if (minInterval == 0 || minInterval > maxInterval) {
+        return false;
+    }
+
+    config.defaultLevel = (buffer[0] << 8) | buffer[1];
+    config.minInterval = minInterval;
+    config.maxInterval = maxInterval;
+    config.noiseTarget = buffer[6];
+    config.sampleBudget = (buffer[7] << 8) | buffer[8];
+    config.compensationTemperature = (buffer[9] << 8) | buffer[10];
+    config.interpolation = buffer[11];
+
+    // The default level may have changed.
+    state.changedChannels = UINT32_MAX;
+
+    return true;
+}
+
+// Serialize the configuration of a level channel. The sampling configuration
+// is only serialized for the local channels. For the channels of a child, it
+// is taken from the register of the child, which is in the buffer already.
+static void _serializeLevelConfig(uint8_t *buffer, unsigned i, unsigned j)
+{
+    if (i == 0) {
+        buffer[1] = (config.local.adc[j].samples & 0xff00) >> 8;
+        buffer[2] = (config.local.adc[j].samples & 0x00ff) >> 0;
+        buffer[3] = config.local.adc[j].alpha;
+        buffer[8] = config.local.adc[j].filter;
+        buffer[9] = config.local.adc[j].period;
+        buffer[11] = config.local.adc[j].compensation;
+        buffer[12] = (config.local.adc[j].coefficient & 0xff00) >> 8;
+        buffer[13] = (config.local.adc[j].coefficient & 0x00ff) >> 0;
+    }
+
+    buffer[0] = config.sensors[i].adc[j].enabled ? 1 : 0;
+    buffer[4] = (config.sensors[i].adc[j].offset & 0xff00) >> 8;
+    buffer[5] = (config.sensors[i].adc[j].offset & 0x00ff) >> 0;
+    buffer[6] = (config.sensors[i].adc[j].level & 0xff00) >> 8;
+    buffer[7] = (config.sensors[i].adc[j].level & 0x00ff) >> 0;
+    buffer[10] = config.sensors[i].adc[j].resolution;
+    buffer[14] = config.sensors[i].adc[j].calibration;
+    buffer[15] = (config.sensors[i].adc[j].dry & 0xff00) >> 8;
+    buffer[16] = (config.sensors[i].adc[j].dry & 0x00ff) >> 0;
+    buffer[17] = (config.sensors[i].adc[j].wet & 0xff00) >> 8;
+    buffer[18] = (config.sensors[i].adc[j].wet & 0x00ff) >> 0;
+    buffer[19] = (config.sensors[i].adc[j].hysteresis & 0xff00) >> 8;
+    buffer[20] = (config.sensors[i].adc[j].hysteresis & 0x00ff) >> 0;
+    buffer[21] = config.sensors[i].adc[j].debounce;
+
+    _seal(buffer, WATER_SENSOR_LEVEL_CONFIG_SIZE);
+}
+
+// Convert a value of a level channel from one resolution to another.
+static uint16_t _rescale(uint16_t value, uint8_t from, uint8_t to)
+{
+    if (to < from) {
+        return value >> (from - to);
+    }
+
+    uint32_t result = (uint32_t)value << (to - from);
+
+    return result > UINT16_MAX ? UINT16_MAX : result;
+}
+
+// Parse the configuration of a level channel. The sampling configuration of
+// the channels of a child is left to the child. Returns false if the
+// configuration is rejected.
+static bool _parseLevelConfig(const uint8_t *buffer, unsigned i, unsigned j)
+{
+    if (buffer[14] > WATER_SENSOR_CALIBRATION_FROZEN) {
+        return false;
+    }
+
+    if (i == 0) {
+        config.local.adc[j].samples = min((unsigned)((buffer[1] << 8) | buffer[2]), WATER_SENSOR_SAMPLES_MAX);
+        config.local.adc[j].alpha = buffer[3];
+        config.local.adc[j].filter = buffer[8];
+        config.local.adc[j].period = buffer[9];
+        config.local.adc[j].compensation = buffer[11];
+        config.local.adc[j].coefficient = (buffer[12] << 8) | buffer[13];
+    }
+
+    uint16_t offset = (buffer[4] << 8) | buffer[5];
+    uint16_t dry = (buffer[15] << 8) | buffer[16];
+    uint16_t wet = (buffer[17] << 8) | buffer[18];
+    uint16_t hysteresis = (buffer[19] << 8) | buffer[20];
+    uint8_t resolution = buffer[10] < WATER_SENSOR_RESOLUTION_MAX ? buffer[10] : WATER_SENSOR_RESOLUTION_MAX;
+    uint8_t previous = config.sensors[i].adc[j].resolution;
+
+    // The offset, the calibration baselines and the hysteresis are in the
+    // scale of the values. Those that the write leaves as they were are
+    // rescaled to the new resolution, so that the calibration still holds.
+    if (resolution != previous) {
+        if (offset == config.sensors[i].adc[j].offset) {
+            offset = _rescale(offset, previous, resolution);
         }
-        case WATER_SENSOR_LOAD:
-        {
-            load();
-            break;
+
+        if (dry == config.sensors[i].adc[j].dry) {
+            dry = _rescale(dry, previous, resolution);
         }
-        case WATER_SENSOR_STORE:
-        {
-            store();
-            break;
+
+        if (wet == config.sensors[i].adc[j].wet) {
+            wet = _rescale(wet, previous, resolution);
         }
-        case WATER_SENSOR_CALIBRATE:
-        {
-            calibrate();
-            break;
+
+        if (hysteresis == config.sensors[i].adc[j].hysteresis) {
+            hysteresis = _rescale(hysteresis, previous, resolution);
         }
-        case WATER_SENSOR_ZERO:
-        {
-            zero();
-            break;
+    }
+
+    config.sensors[i].adc[j].enabled = buffer[0] != 0;
+    config.sensors[i].adc[j].offset = offset;
+    config.sensors[i].adc[j].level = (buffer[6] << 8) | buffer[7];
+    config.sensors[i].adc[j].calibration = buffer[14];
+    config.sensors[i].adc[j].dry = dry;
+    config.sensors[i].adc[j].wet = wet;
+    config.sensors[i].adc[j].hysteresis = hysteresis;
+    config.sensors[i].adc[j].debounce = buffer[21];
+
+    // Values in another scale cannot be mixed with the current ones.
+    if (resolution != previous) {
+        config.sensors[i].adc[j].resolution = resolution;
+
+        if (i == 0) {
+            filterReset(&filters[j]);
         }
-        case WATER_SENSOR_READ_INFO:
-        {
-            int sensors = 1 + info.children;
 
-            response.buffer[0] = info.id;
-            response.buffer[1] = sensors * NUM_CHANNELS;
-            response.buffer[2] = sensors;
-            response.buffer[3] = state.enabled ? 1 : 0;
-            response.buffer[4] = state.errors;
-            response.buffer[5] = state.context;
+        state.zeroedChannels |= (uint32_t)1 << ((i * NUM_CHANNELS) + j);
+    }
 
-            response.length = WATER_SENSOR_INFO_SIZE;
+    updateChannel(i, j, false);
 
-            break;
-        }
-        case WATER_SENSOR_READ_LEVEL:
-        {
-            response.buffer[0] = (state.level.value & 0xff00) >> 8;
-            response.buffer[1] = (state.level.value & 0x00ff) >> 0;
-            response.buffer[2] = state.level.channel;
-            response.buffer[3] = state.level.valid;
+    // The level of the channel may have changed.
+    state.changedChannels |= (uint32_t)1 << ((i * NUM_CHANNELS) + j);
 
-            response.length = WATER_SENSOR_LEVEL_SIZE;
+    return true;
+}
 
-            break;
-        }
-        case WATER_SENSOR_READ_TEMPERATURE:
-        {
-            response.buffer[0] = (state.temperature.value & 0xff00) >> 8;
-            response.buffer[1] = (state.temperature.value & 0x00ff) >> 0;
-            response.buffer[2] = state.temperature.channel;
-            response.buffer[3] = state.temperature.valid;
+static void _serializeTemperatureConfig(uint8_t *buffer)
+{
+    buffer[0] = config.local.temperature.enabled ? 1 : 0;
+    buffer[1] = config.local.temperature.alpha;
+    buffer[2] = (config.local.temperature.reference & 0xff00) >> 8;
+    buffer[3] = (config.local.temperature.reference & 0x00ff) >> 0;
+    buffer[4] = config.local.temperature.filter;
+    buffer[5] = config.local.temperature.period;
+
+    _seal(buffer, WATER_SENSOR_TEMPERATURE_CONFIG_SIZE);
+}
 
-            response.length = WATER_SENSOR_TEMPERATURE_SIZE;
+static void _parseTemperatureConfig(const uint8_t *buffer)
+{
+    config.local.temperature.enabled = buffer[0] != 0;
+    config.local.temperature.alpha = buffer[1];
+    config.local.temperature.reference = (buffer[2] << 8) | buffer[3];
+    config.local.temperature.filter = buffer[4];
+    config.local.temperature.period = buffer[5];
+
+    // A disabled temperature is not taken into account by the parent.
+    if (!config.local.temperature.enabled) {
+        state.sensors[0].temperature.valid = false;
+    }
 
-            break;
-        }
-        case WATER_SENSOR_READ_LEVEL_RAW:
-        {
-            if (countToRead != 2) {
-                response.nack = true;
-                return;
-            }
+    state.changedSensors |= _BV(0);
+}
 
-            int channel = Wire.read();
+static void _serializeStatistics(uint8_t *buffer, const statistics_t *statistics)
+{
+    // The variance is only computed when the register is selected.
+    uint32_t variance = statistics->count ? statistics->deviation / statistics->count : 0;
+
+    buffer[0] = statistics->count;
+    buffer[1] = (statistics->mean & 0xff000000) >> 24;
+    buffer[2] = (statistics->mean & 0x00ff0000) >> 16;
+    buffer[3] = (statistics->mean & 0x0000ff00) >> 8;
+    buffer[4] = (statistics->mean & 0x000000ff) >> 0;
+    buffer[5] = (variance & 0xff000000) >> 24;
+    buffer[6] = (variance & 0x00ff0000) >> 16;
+    buffer[7] = (variance & 0x0000ff00) >> 8;
+    buffer[8] = (variance & 0x000000ff) >> 0;
+
+    _seal(buffer, WATER_SENSOR_STATISTICS_SIZE);
+}
 
-            int i = channel / NUM_CHANNELS;
-            int j = channel % NUM_CHANNELS;
+static void _updateStatistics(statistics_t *statistics, int16_t value)
+{
+    int32_t x = (int32_t)value << 8;
+    uint8_t count = statistics->count;
+    int32_t mean = statistics->mean;
+    uint32_t deviation = statistics->deviation;
+
+    // Welford's algorithm, with a moving average instead of the mean, so
+    // that nothing has to be divided. The average starts at the first value.
+    // Once the window is full, older deviations are forgotten gradually.
+    if (count == 0) {
+        mean = x;
+    }
 
-            response.buffer[0] = (state.sensors[i].adc[j].value & 0xff00) >> 8;
-            response.buffer[1] = (state.sensors[i].adc[j].value & 0x00ff) >> 0;
-            response.buffer[2] = (state.sensors[i].adc[j].min & 0xff00) >> 8;
-            response.buffer[3] = (state.sensors[i].adc[j].min & 0x00ff) >> 0;
-            response.buffer[4] = (state.sensors[i].adc[j].max & 0xff00) >> 8;
-            response.buffer[5] = (state.sensors[i].adc[j].max & 0x00ff) >> 0;
-            response.buffer[6] = state.sensors[i].adc[j].valid;
+    if (count < WATER_SENSOR_STATISTICS_WINDOW) {
+        count++;
+    }
+    else {
+        deviation -= deviation >> STATISTICS_SHIFT;
+    }
 
-            response.length = WATER_SENSOR_LEVEL_RAW_SIZE;
+    int32_t delta = x - mean;
 
-            break;
-        }
-        case WATER_SENSOR_READ_TEMPERATURE_RAW:
-        {
-            if (countToRead != 2) {
-                response.nack = true;
-                return;
-            }
+    mean += delta >> STATISTICS_SHIFT;
 
-            int channel = Wire.read();
+    // Both deviations are scaled down to 16 bits, so that their product (with
+    // eight fractional bits) fits in 32 bits.
+    int32_t before = constrain(delta >> 4, -INT16_MAX, INT16_MAX);
+    int32_t after = constrain((x - mean) >> 4, -INT16_MAX, INT16_MAX);
+    uint32_t product = before * after;
 
-            int i = channel % NUM_SENSORS;
+    deviation = product > (UINT32_MAX - deviation) ? UINT32_MAX : deviation + product;
 
-            response.buffer[0] = (state.sensors[i].temperature.value & 0xff00) >> 8;
-            response.buffer[1] = (state.sensors[i].temperature.value & 0x00ff) >> 0;
-            response.buffer[2] = (state.sensors[i].temperature.min & 0xff00) >> 8;
-            response.buffer[3] = (state.sensors[i].temperature.min & 0x00ff) >> 0;
-            response.buffer[4] = (state.sensors[i].temperature.max & 0xff00) >> 8;
-            response.buffer[5] = (state.sensors[i].temperature.max & 0x00ff) >> 0;
-            response.buffer[6] = state.sensors[i].temperature.valid;
+    statistics->count = count;
+    statistics->mean = mean;
+    statistics->deviation = deviation;
+}
 
-            response.length = WATER_SENSOR_TEMPERATURE_RAW_SIZE;
+// Locate the register that contains an address, which is within the
+// statistics and configuration registers.
+static void _locateRegister(uint16_t address, register_location_t *location)
+{
+    uint8_t type;
+    uint16_t start;
+    uint8_t size;
+
+    if (address < WATER_SENSOR_REG_TEMPERATURE_STATISTICS(0)) {
+        type = REGISTER_LEVEL_STATISTICS;
+        start = WATER_SENSOR_REG_LEVEL_STATISTICS(0);
+        size = WATER_SENSOR_STATISTICS_SIZE;
+    }
+    else if (address < WATER_SENSOR_REG_CONFIG) {
+        type = REGISTER_TEMPERATURE_STATISTICS;
+        start = WATER_SENSOR_REG_TEMPERATURE_STATISTICS(0);
+        size = WATER_SENSOR_STATISTICS_SIZE;
+    }
+    else if (address < WATER_SENSOR_REG_LEVEL_CONFIG(0)) {
+        type = REGISTER_CONFIG;
+        start = WATER_SENSOR_REG_CONFIG;
+        size = WATER_SENSOR_CONFIG_SIZE;
+    }
+    else if (address < WATER_SENSOR_REG_TEMPERATURE_CONFIG(0)) {
+        type = REGISTER_LEVEL_CONFIG;
+        start = WATER_SENSOR_REG_LEVEL_CONFIG(0);
+        size = WATER_SENSOR_LEVEL_CONFIG_SIZE;
+    }
+    else {
+        type = REGISTER_TEMPERATURE_CONFIG;
+        start = WATER_SENSOR_REG_TEMPERATURE_CONFIG(0);
+        size = WATER_SENSOR_TEMPERATURE_CONFIG_SIZE;
+    }
 
-            break;
-        }
-        case WATER_SENSOR_READ_CONFIG:
-        {
-            response.buffer[0] = (config.defaultLevel & 0xff00) >> 8;
-            response.buffer[1] = (config.defaultLevel & 0x00ff) >> 0;
+    location->type = type;
+    location->index = (address - start) / WATER_SENSOR_REG_STRIDE(size);
+    location->start = start + (location->index * WATER_SENSOR_REG_STRIDE(size));
+    location->size = size;
+}
 
-            response.length = WATER_SENSOR_CONFIG_SIZE;
+// Returns true if a register belongs to a child, which holds it itself. The
+// configuration of the level channels of a child is partly held by the
+// parent as well.
+static bool _isProxied(const register_location_t *location)
+{
+    switch (location->type) {
+        case REGISTER_LEVEL_STATISTICS:
+        case REGISTER_LEVEL_CONFIG:
+            return location->index >= NUM_CHANNELS;
+        case REGISTER_TEMPERATURE_STATISTICS:
+        case REGISTER_TEMPERATURE_CONFIG:
+            return location->index > 0;
+    }
 
-            break;
-        }
-        case WATER_SENSOR_WRITE_CONFIG:
-        {
-            if (countToRead != 4) {
-                response.nack = true;
-                return;
-            }
+    return false;
+}
 
-            if (!_read(WATER_SENSOR_CONFIG_SIZE)) {
-                response.nack = true;
-                return;
-            }
+// Address of a register of a child, as located in the registers of the
+// parent, in the registers of that child (of which it is sensor 0).
+static uint16_t _childRegister(const register_location_t *location, unsigned *child)
+{
+    unsigned j = location->index % NUM_CHANNELS;
+
+    switch (location->type) {
+        case REGISTER_LEVEL_STATISTICS:
+            *child = (location->index / NUM_CHANNELS) - 1;
+            return WATER_SENSOR_REG_LEVEL_STATISTICS(j);
+        case REGISTER_LEVEL_CONFIG:
+            *child = (location->index / NUM_CHANNELS) - 1;
+            return WATER_SENSOR_REG_LEVEL_CONFIG(j);
+        case REGISTER_TEMPERATURE_STATISTICS:
+            *child = location->index - 1;
+            return WATER_SENSOR_REG_TEMPERATURE_STATISTICS(0);
+    }
 
-            config.defaultLevel = (response.buffer[0] << 8) | response.buffer[1];
+    *child = location->index - 1;
+    return WATER_SENSOR_REG_TEMPERATURE_CONFIG(0);
+}
 
-            break;
-        }
-        case WATER_SENSOR_READ_LEVEL_CONFIG:
-        {
-            if (countToRead != 2) {
-                response.nack = true;
-                return;
-            }
+// Serialize a local register, including its checksum.
+static void _serializeRegister(const register_location_t *location, uint8_t *buffer)
+{
+    unsigned i = location->index / NUM_CHANNELS;
+    unsigned j = location->index % NUM_CHANNELS;
 
-            int channel = Wire.read();
+    switch (location->type) {
+        case REGISTER_LEVEL_STATISTICS:
+            _serializeStatistics(buffer, &statistics[j]);
+            break;
+        case REGISTER_TEMPERATURE_STATISTICS:
+            _serializeStatistics(buffer, &statistics[SAMPLER_SLOT_TEMPERATURE]);
+            break;
+        case REGISTER_CONFIG:
+            _serializeConfig(buffer);
+            break;
+        case REGISTER_LEVEL_CONFIG:
+            _serializeLevelConfig(buffer, i, j);
+            break;
+        case REGISTER_TEMPERATURE_CONFIG:
+            _serializeTemperatureConfig(buffer);
+            break;
+    }
+}
 
-            int i = channel / NUM_CHANNELS;
-            int j = channel % NUM_CHANNELS;
+// Make the selected register ready to be read, once it is serialized in its
+// buffer. The part before the selected address is dropped. The host may have
+// selected another register in the meantime.
+static void _readySelected(uint16_t address, const register_location_t *location)
+{
+    uint8_t offset = address - location->start;
+    uint8_t length = WATER_SENSOR_REG_STRIDE(location->size) - offset;
 
-            response.buffer[0] = config.sensors[i].adc[j].enabled ? 1 : 0;
-            response.buffer[1] = (config.sensors[i].adc[j].samples & 0xff00) >> 8;
-            response.buffer[2] = (config.sensors[i].adc[j].samples & 0x00ff) >> 0;
-            response.buffer[3] = config.sensors[i].adc[j].alpha;
-            response.buffer[4] = (config.sensors[i].adc[j].offset & 0xff00) >> 8;
-            response.buffer[5] = (config.sensors[i].adc[j].offset & 0x00ff) >> 0;
-            response.buffer[6] = (config.sensors[i].adc[j].level & 0xff00) >> 8;
-            response.buffer[7] = (config.sensors[i].adc[j].level & 0x00ff) >> 0;
+    memmove(selected.buffer, &selected.buffer[offset], length);
 
-            response.length = WATER_SENSOR_LEVEL_CONFIG_SIZE;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (selected.address == address && selected.status == SELECTED_PENDING) {
+            selected.length = length;
+            selected.status = SELECTED_READY;
+        }
+    }
+}
 
-            break;
+// Mark the selected register as failed, so that it reads as invalid until it
+// is selected again.
+static void _failSelected(uint16_t address)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (selected.address == address && selected.status == SELECTED_PENDING) {
+            selected.status = SELECTED_FAILED;
         }
-        case WATER_SENSOR_WRITE_LEVEL_CONFIG:
-        {
-            if (countToRead != 11) {
-                response.nack = true;
-                return;
-            }
+    }
+}
+
+// Make the selected register of a child ready, once it is fetched. The parent
+// holds the configuration that it determines the level with.
+static void _fetchedSelected(const uint8_t *data)
+{
+    register_location_t location;
+    bool pending;
 
-            int channel = Wire.read();
+    // The buffer is only written while the fetched register is pending.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        pending = selected.address == operation.address && selected.status == SELECTED_PENDING;
+    }
 
-            int i = channel / NUM_CHANNELS;
-            int j = channel % NUM_CHANNELS;
+    if (!pending) {
+        return;
+    }
 
-            if (!_read(WATER_SENSOR_LEVEL_CONFIG_SIZE)) {
-                response.nack = true;
-                return;
-            }
+    _locateRegister(operation.address, &location);
+    memcpy(selected.buffer, data, WATER_SENSOR_REG_STRIDE(location.size));
 
-            config.sensors[i].adc[j].enabled = response.buffer[0] != 0;
-            config.sensors[i].adc[j].samples = (response.buffer[1] << 8) | response.buffer[2];
-            config.sensors[i].adc[j].alpha = response.buffer[3];
-            config.sensors[i].adc[j].offset = (response.buffer[4] << 8) | response.buffer[5];
-            config.sensors[i].adc[j].level = (response.buffer[6] << 8) | response.buffer[7];
+    if (location.type == REGISTER_LEVEL_CONFIG) {
+        _serializeLevelConfig(selected.buffer, location.index / NUM_CHANNELS, location.index % NUM_CHANNELS);
+    }
 
-            break;
+    _readySelected(operation.address, &location);
+}
+
+// Prepare the selected register again when it is next selected, if it is
+// within a register that changed.
+static void _invalidateSelected(const register_location_t *location)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (selected.address >= location->start && selected.address < location->start + WATER_SENSOR_REG_STRIDE(location->size)) {
+            selected.status = SELECTED_IDLE;
         }
-        case WATER_SENSOR_READ_TEMPERATURE_CONFIG:
-        {
-            if (countToRead != 2) {
-                response.nack = true;
-                return;
+    }
+}
+
+// Parse a configuration register, of which the checksum is valid. The
+// temperature configuration of a child is only held by the child. Returns
+// false if the configuration is rejected.
+static bool _parseRegister(const register_location_t *location, const uint8_t *buffer)
+{
+    switch (location->type) {
+        case REGISTER_CONFIG:
+            return _parseConfig(buffer);
+        case REGISTER_LEVEL_CONFIG:
+            return _parseLevelConfig(buffer, location->index / NUM_CHANNELS, location->index % NUM_CHANNELS);
+        case REGISTER_TEMPERATURE_CONFIG:
+            if (location->index == 0) {
+                _parseTemperatureConfig(buffer);
             }
+            break;
+    }
 
-            int channel = Wire.read();
+    return true;
+}
 
-            int i = channel % NUM_CHANNELS;
+// Publish the state registers. The info register reads as invalid while the
+// other registers are published, and is published last, with the next sequence
+// number. A transfer that contains a valid info register therefore never
+// contains parts of two states, and neither do the transfers in between two
+// reads of the info register with the same sequence number.
+void publishStateRegisters()
+{
+    uint8_t buffer[WATER_SENSOR_REG_STRIDE(WATER_SENSOR_SNAPSHOT_SIZE)];
+    unsigned sensors = 1 + info.children;
+
+    // A single byte is written atomically.
+    stateRegisters[WATER_SENSOR_REG_INFO + WATER_SENSOR_INFO_SIZE] = ~_checksum(&stateRegisters[WATER_SENSOR_REG_INFO], WATER_SENSOR_INFO_SIZE);
+
+    buffer[0] = (state.level.value & 0xff00) >> 8;
+    buffer[1] = (state.level.value & 0x00ff) >> 0;
+    buffer[2] = state.level.channel;
+    buffer[3] = state.level.valid;
+    buffer[4] = (state.level.interpolated & 0xff000000) >> 24;
+    buffer[5] = (state.level.interpolated & 0x00ff0000) >> 16;
+    buffer[6] = (state.level.interpolated & 0x0000ff00) >> 8;
+    buffer[7] = (state.level.interpolated & 0x000000ff) >> 0;
+    _seal(buffer, WATER_SENSOR_LEVEL_SIZE);
+    _publishRegister(WATER_SENSOR_REG_LEVEL, buffer, WATER_SENSOR_LEVEL_SIZE);
+
+    buffer[0] = (state.temperature.value & 0xff00) >> 8;
+    buffer[1] = (state.temperature.value & 0x00ff) >> 0;
+    buffer[2] = state.temperature.channel;
+    buffer[3] = state.temperature.valid;
+    _seal(buffer, WATER_SENSOR_TEMPERATURE_SIZE);
+    _publishRegister(WATER_SENSOR_REG_TEMPERATURE, buffer, WATER_SENSOR_TEMPERATURE_SIZE);
+
+    buffer[0] = (state.level.wet & 0xff000000) >> 24;
+    buffer[1] = (state.level.wet & 0x00ff0000) >> 16;
+    buffer[2] = (state.level.wet & 0x0000ff00) >> 8;
+    buffer[3] = (state.level.wet & 0x000000ff) >> 0;
+    _seal(buffer, WATER_SENSOR_WET_SIZE);
+    _publishRegister(WATER_SENSOR_REG_WET, buffer, WATER_SENSOR_WET_SIZE);
 
-            response.buffer[0] = config.sensors[i].temperature.enabled ? 1 : 0;
-            response.buffer[1] = config.sensors[i].temperature.alpha;
-            response.buffer[2] = (config.sensors[i].temperature.reference & 0xff00) >> 8;
-            response.buffer[3] = (config.sensors[i].temperature.reference & 0x00ff) >> 0;
+    for (unsigned i = 0; i < NUM_SENSORS; i++) {
+        _serializeSnapshot(buffer, i);
+        _seal(buffer, WATER_SENSOR_SNAPSHOT_SIZE);
+        _publishRegister(WATER_SENSOR_REG_SNAPSHOT(i), buffer, WATER_SENSOR_SNAPSHOT_SIZE);
+    }
 
-            response.length = WATER_SENSOR_TEMPERATURE_CONFIG_SIZE;
+    // The reset minimums and maximums are published now.
+    state.zeroedChannels = 0;
+    state.zeroedSensors = 0;
+
+    buffer[0] = (state.level.faults & 0xff000000) >> 24;
+    buffer[1] = (state.level.faults & 0x00ff0000) >> 16;
+    buffer[2] = (state.level.faults & 0x0000ff00) >> 8;
+    buffer[3] = (state.level.faults & 0x000000ff) >> 0;
+    buffer[4] = state.level.confidence;
+    _seal(buffer, WATER_SENSOR_FAULTS_SIZE);
+    _publishRegister(WATER_SENSOR_REG_FAULTS, buffer, WATER_SENSOR_FAULTS_SIZE);
+
+    sequence++;
+
+    buffer[0] = info.id;
+    buffer[1] = sensors * NUM_CHANNELS;
+    buffer[2] = sensors;
+    buffer[3] = state.enabled ? 1 : 0;
+    buffer[4] = state.errors;
+    buffer[5] = state.context;
+    buffer[6] = (sequence & 0xff00) >> 8;
+    buffer[7] = (sequence & 0x00ff) >> 0;
+    buffer[8] = (state.interval & 0xff00) >> 8;
+    buffer[9] = (state.interval & 0x00ff) >> 0;
+    buffer[10] = (state.changes & 0xff00) >> 8;
+    buffer[11] = (state.changes & 0x00ff) >> 0;
+    _seal(buffer, WATER_SENSOR_INFO_SIZE);
+    _publishRegister(WATER_SENSOR_REG_INFO, buffer, WATER_SENSOR_INFO_SIZE);
+}
 
-            break;
-        }
-        case WATER_SENSOR_WRITE_TEMPERATURE_CONFIG:
-        {
-            if (countToRead != 7) {
-                response.nack = true;
-                return;
-            }
+void updateStatusRegister(uint8_t index, uint8_t status)
+{
+    statusRegister[index] = (statusRegister[index] & ~WATER_SENSOR_STATUS_MASK) | status;
+    _seal(statusRegister, WATER_SENSOR_STATUS_SIZE);
+}
 
-            int channel = Wire.read();
+// Count a received command (or write), and update its status.
+static void _receiveStatusRegister(uint8_t index, uint8_t status)
+{
+    statusRegister[index] += _BV(WATER_SENSOR_STATUS_COUNT_SHIFT);
+    updateStatusRegister(index, status);
+}
 
-            int i = channel % NUM_SENSORS;
+void updateLatchedRegister()
+{
+    uint8_t buffer[WATER_SENSOR_REG_STRIDE(WATER_SENSOR_SNAPSHOT_SIZE)];
 
-            if (!_read(WATER_SENSOR_TEMPERATURE_CONFIG_SIZE)) {
-                response.nack = true;
-                return;
-            }
+    latch++;
 
-            config.sensors[i].temperature.enabled = response.buffer[0] != 0;
-            config.sensors[i].temperature.alpha = response.buffer[1];
-            config.sensors[i].temperature.reference = (response.buffer[2] << 8) | response.buffer[3];
+    _serializeSnapshot(buffer, 0);
+    buffer[WATER_SENSOR_SNAPSHOT_VALID] |= (latch & WATER_SENSOR_SNAPSHOT_LATCH_MASK) << WATER_SENSOR_SNAPSHOT_LATCH_SHIFT;
+    _seal(buffer, WATER_SENSOR_SNAPSHOT_SIZE);
 
-            break;
-        }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memcpy(latchedRegister, buffer, sizeof(latchedRegister));
     }
 }
 
-void requestEvent()
+static unsigned _nextChild(uint8_t mask, unsigned i)
 {
-    uint8_t checksum = 0xff;
+    while (i < info.children && !(mask & _BV(i))) {
+        i++;
+    }
 
-    if (response.length) {
-        for (unsigned i = 0; i < response.length; i++) {
-            checksum ^= response.buffer[i];
-        }
+    return i;
+}
+
+static void _setOperationRegister(uint16_t reg, uint8_t length)
+{
+    operation.header[0] = (reg & 0xff00) >> 8;
+    operation.header[1] = (reg & 0x00ff) >> 0;
+    operation.length = length;
+}
+
+void operationDone(int result, const uint8_t *data, size_t length, void *arg);
+
+// Queue the transfer of the current phase of the operation, with the current
+// child.
+static void _stepOperation()
+{
+    wire_master_transfer_t *transfer = &operation.transfer;
+
+    transfer->address = SENSOR_ADDRESS(1 + operation.child);
+    transfer->callback = operationDone;
+    transfer->arg = NULL;
+
+    if (operation.phase == OPERATION_BROADCAST) {
+        transfer->address = WATER_SENSOR_I2C_GENERAL_CALL;
+        transfer->writeData = &operation.command;
+        transfer->writeLength = 1;
+        transfer->readLength = 0;
+    }
+    else if (operation.phase == OPERATION_WRITE) {
+        transfer->writeData = written.buffer;
+        transfer->writeLength = operation.length;
+        transfer->readLength = 0;
+    }
+    else {
+        transfer->writeData = operation.header;
+        transfer->writeLength = sizeof(operation.header);
+        transfer->readLength = operation.length;
+    }
 
-        Wire.write(response.buffer, response.length);
-        Wire.write(checksum);
+    // If the queue is full, it is tried again later.
+    if (wireMaster.submit(transfer) != WIRE_MASTER_OK) {
+        operation.waiting = true;
+        operation.time = millis();
+        return;
     }
+
+    operation.busy = true;
 }
 
-uint8_t readConfigPins(void)
+static void _startOperation(uint8_t phase, uint8_t command, uint8_t index, uint8_t pending)
 {
-    pinMode(PIN_CONFIG_0, INPUT_PULLUP);
-    pinMode(PIN_CONFIG_1, INPUT_PULLUP);
-    pinMode(PIN_CONFIG_2, INPUT_PULLUP);
-    pinMode(PIN_CONFIG_3, INPUT_PULLUP);
+    operation.phase = phase;
+    operation.command = command;
+    operation.index = index;
+    operation.pending = pending;
+    operation.child = _nextChild(pending, 0);
+    operation.result = 0;
+    operation.waiting = false;
+    operation.start = millis();
+
+    _stepOperation();
+}
 
-    return
-        (digitalRead(PIN_CONFIG_0) == HIGH ? 0 : 1) << 0 |
-        (digitalRead(PIN_CONFIG_1) == HIGH ? 0 : 1) << 1 |
-        (digitalRead(PIN_CONFIG_2) == HIGH ? 0 : 1) << 2 |
-        (digitalRead(PIN_CONFIG_3) == HIGH ? 0 : 1) << 3;
+// Read the status of the pending children in the given phase, starting with
+// the first one.
+static void _readStatus(uint8_t phase)
+{
+    operation.phase = phase;
+    operation.child = _nextChild(operation.pending, 0);
+    operation.start = millis();
+
+    _setOperationRegister(WATER_SENSOR_REG_STATUS, WATER_SENSOR_REG_STRIDE(WATER_SENSOR_STATUS_SIZE));
+    _stepOperation();
 }
 
-void setupParent()
+// Poll the status of the pending children, until they executed the command or
+// applied the write.
+static void _pollStatus()
 {
-    Wire.onRequest(requestEvent);
-    Wire.onReceive(receiveEvent);
-    Wire.begin(0x70);
+    _readStatus(OPERATION_STATUS);
+}
 
-    Wire2.setTxBuffer(swTxBuffer, sizeof(swTxBuffer));
-    Wire2.setRxBuffer(swRxBuffer, sizeof(swRxBuffer));
-    Wire2.setDelay_us(5);
-    Wire2.setTimeout(500);
-    Wire2.begin();
+// Storing the configuration writes the EEPROM of the children, which takes
+// longer than the other commands.
+static unsigned long _operationTimeout()
+{
+    return operation.command == WATER_SENSOR_STORE ? WATER_SENSOR_STORE_TIMEOUT : WATER_SENSOR_WAIT_TIMEOUT;
+}
 
-    for (unsigned i = 0; i < NUM_SENSORS; i++) {
-        waterSensor[i].setAddress(0x40 + ((i + 1) << 2));
-        waterSensor[i].setWire(&Wire2);
+// Whether a child received the broadcast command, which counts it.
+static bool _receivedCommand(uint8_t status, unsigned child)
+{
+    uint8_t count = (uint8_t)(status - operation.counts[child]) >> WATER_SENSOR_STATUS_COUNT_SHIFT;
+
+    return count == 1;
+}
+
+static void _completeWrite(uint8_t status)
+{
+    // A write that was rejected in the meantime keeps its status.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if ((statusRegister[WATER_SENSOR_STATUS_WRITE] & WATER_SENSOR_STATUS_MASK) == WATER_SENSOR_STATUS_PENDING) {
+            updateStatusRegister(WATER_SENSOR_STATUS_WRITE, status);
+        }
+
+        written.pending = false;
     }
 }
 
-void setupChild()
+static void _finishOperation()
 {
-    Wire.onRequest(requestEvent);
-    Wire.onReceive(receiveEvent);
-    Wire.begin(0x40 + (info.index << 2));
+    uint8_t phase = operation.phase;
+
+    operation.phase = OPERATION_IDLE;
+
+    // A fetch completes with the status of the fetched register.
+    if (operation.command) {
+        finishCommand(operation.command, operation.result, phase == OPERATION_DETECT);
+    }
+    else if (operation.index == WATER_SENSOR_STATUS_WRITE) {
+        _completeWrite(operation.result == 0 ? WATER_SENSOR_STATUS_DONE : WATER_SENSOR_STATUS_FAILED);
+    }
 }
 
-int initChildren()
+void operationDone(int result, const uint8_t *data, size_t length, void *arg)
 {
-    int result = 0;
-    water_sensor_info_t response;
+    (void)arg;
+
+    unsigned i = operation.child;
+    bool valid = result == WIRE_MASTER_OK && length > 0 && length == operation.length && _isSealed(data, length - 1);
+
+    operation.busy = false;
+
+    switch (operation.phase) {
+        case OPERATION_DETECT:
+            // Every child is detected, and all of them are reset at once if
+            // they are.
+            if (!valid || data[0] != WATER_SENSOR_ID) {
+                operation.result = 1 + i;
+            }
+
+            operation.child = _nextChild(operation.pending, i + 1);
+
+            if (operation.child < info.children) {
+                _stepOperation();
+            }
+            else if (operation.result != 0) {
+                _finishOperation();
+            }
+            else {
+                _readStatus(OPERATION_COUNT);
+            }
+
+            break;
+        case OPERATION_COUNT:
+            // A child that cannot be read now would not be told from one
+            // that missed the command later.
+            if (!valid) {
+                operation.result = 1 + i;
+                _finishOperation();
+                break;
+            }
+
+            operation.counts[i] = data[operation.index] & ~WATER_SENSOR_STATUS_MASK;
+            operation.child = _nextChild(operation.pending, i + 1);
+
+            if (operation.child < info.children) {
+                _stepOperation();
+            }
+            else {
+                operation.phase = OPERATION_BROADCAST;
+                _stepOperation();
+            }
+
+            break;
+        case OPERATION_BROADCAST:
+            if (result != WIRE_MASTER_OK) {
+                operation.result = WATER_SENSOR_INFO_CONTEXT_ALL;
+                _finishOperation();
+                break;
+            }
+
+            _pollStatus();
+            break;
+        case OPERATION_WRITE:
+            // A child that did not accept the write is not polled.
+            if (result != WIRE_MASTER_OK) {
+                operation.result = 1 + i;
+                operation.pending &= ~_BV(i);
+            }
+
+            operation.child = _nextChild(operation.pending, i + 1);
+
+            if (operation.child < info.children) {
+                _stepOperation();
+            }
+            else if (operation.pending) {
+                _pollStatus();
+            }
+            else {
+                _finishOperation();
+            }
+
+            break;
+        case OPERATION_STATUS:
+            // The status of a command is only the status of the broadcast
+            // command if the child received it. A written register is sent
+            // to every child on its own, and its reception is acknowledged.
+            if (!valid || (operation.command && !_receivedCommand(data[operation.index], i))) {
+                operation.result = 1 + i;
+                operation.pending &= ~_BV(i);
+            }
+            else if ((data[operation.index] & WATER_SENSOR_STATUS_MASK) != WATER_SENSOR_STATUS_PENDING) {
+                if ((data[operation.index] & WATER_SENSOR_STATUS_MASK) != WATER_SENSOR_STATUS_DONE) {
+                    operation.result = 1 + i;
+                }
+
+                operation.pending &= ~_BV(i);
+            }
+
+            operation.child = _nextChild(operation.pending, i + 1);
+
+            if (operation.child < info.children) {
+                _stepOperation();
+                break;
+            }
+
+            // All pending children are polled once. The children that are
+            // still pending are polled again after a while.
+            if (!operation.pending) {
+                _finishOperation();
+            }
+            else if (millis() - operation.start >= _operationTimeout()) {
+                operation.result = 1 + _nextChild(operation.pending, 0);
+                _finishOperation();
+            }
+            else {
+                operation.child = _nextChild(operation.pending, 0);
+                operation.waiting = true;
+                operation.time = millis();
+            }
+
+            break;
+        case OPERATION_FETCH:
+            // A child serves some registers only after they are selected, so
+            // an invalid checksum is read again after a while.
+            if (!valid && millis() - operation.start < WATER_SENSOR_WAIT_TIMEOUT) {
+                operation.waiting = true;
+                operation.time = millis();
+                break;
+            }
+
+            if (valid) {
+                _fetchedSelected(data);
+            }
+            else {
+                _failSelected(operation.address);
+            }
+
+            _finishOperation();
+            break;
+    }
+}
+
+// Continue the operation on the children, once it waited long enough.
+void pollChildren()
+{
+    if (operation.phase == OPERATION_IDLE || operation.busy || !operation.waiting) {
+        return;
+    }
+
+    if (millis() - operation.time < WATER_SENSOR_WAIT_INTERVAL) {
+        return;
+    }
+
+    operation.waiting = false;
+
+    _stepOperation();
+}
+
+// Forward a written register to the children that hold it. Returns
+// COMMAND_PENDING if it is forwarded in the background.
+int forwardRegister(const register_location_t *location)
+{
+    uint8_t *buffer = &written.buffer[WRITTEN_DATA];
+    uint8_t targets;
+    uint16_t reg;
+    unsigned child;
+
+    if (location->type == REGISTER_CONFIG) {
+        // All children sample with the same configuration.
+        if (info.children == 0) {
+            return 0;
+        }
+
+        reg = WATER_SENSOR_REG_CONFIG;
+        targets = _BV(info.children) - 1;
+    }
+    else if (_isProxied(location)) {
+        reg = _childRegister(location, &child);
+
+        if (child >= info.children) {
+            return 1 + child;
+        }
+
+        targets = _BV(child);
+
+        // The parent calibrates the channels of the children, so a child
+        // should not move the offsets that the parent determines the level
+        // with. The register was parsed already, so it can be changed.
+        if (location->type == REGISTER_LEVEL_CONFIG) {
+            buffer[14] = WATER_SENSOR_CALIBRATION_OFF;
+            _seal(buffer, WATER_SENSOR_LEVEL_CONFIG_SIZE);
+        }
+    }
+    else {
+        return 0;
+    }
+
+    written.buffer[0] = (reg & 0xff00) >> 8;
+    written.buffer[1] = (reg & 0x00ff) >> 0;
+
+    operation.length = WRITTEN_DATA + WATER_SENSOR_REG_STRIDE(location->size);
+    _startOperation(OPERATION_WRITE, 0, WATER_SENSOR_STATUS_WRITE, targets);
+
+    return COMMAND_PENDING;
+}
+
+// Prepare the register that the host selected. A register of a child is
+// fetched from the child in the background, once the operation on the
+// children in progress completed.
+void prepareSelected()
+{
+    register_location_t location;
+    uint16_t address;
+    unsigned child;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        address = selected.address;
+    }
+
+    _locateRegister(address, &location);
+
+    if (!_isProxied(&location)) {
+        _serializeRegister(&location, selected.buffer);
+        _readySelected(address, &location);
+        return;
+    }
+
+    if (operation.phase != OPERATION_IDLE) {
+        return;
+    }
+
+    uint16_t reg = _childRegister(&location, &child);
+
+    if (child >= info.children) {
+        _failSelected(address);
+        return;
+    }
+
+    operation.address = address;
+    _setOperationRegister(reg, WATER_SENSOR_REG_STRIDE(location.size));
+    _startOperation(OPERATION_FETCH, 0, 0, _BV(child));
+}
+
+void applyWrittenRegister()
+{
+    register_location_t location;
+    uint8_t *buffer = &written.buffer[WRITTEN_DATA];
+    bool parsed = false;
+    int result;
+
+    _locateRegister(written.address, &location);
+
+    // Only whole configuration registers are writable.
+    if (location.type >= REGISTER_CONFIG && written.address == location.start && written.length == WATER_SENSOR_REG_STRIDE(location.size) && _isSealed(buffer, location.size)) {
+        parsed = _parseRegister(&location, buffer);
+    }
+
+    if (!parsed) {
+        _completeWrite(WATER_SENSOR_STATUS_FAILED);
+        return;
+    }
+
+    // A prepared copy of the register is outdated, so it is prepared again.
+    _invalidateSelected(&location);
+
+    // A register that is forwarded to the children completes once they
+    // applied it.
+    result = forwardRegister(&location);
+
+    if (result != COMMAND_PENDING) {
+        _completeWrite(result == 0 ? WATER_SENSOR_STATUS_DONE : WATER_SENSOR_STATUS_FAILED);
+    }
+}
+
+// Reset the sampling state of the local channels, which is derived from their
+// configuration.
+void resetSampling()
+{
+    for (unsigned i = 0; i < SAMPLER_SLOTS; i++) {
+        filterReset(&filters[i]);
+        countdown[i] = 0;
+    }
+
+    for (unsigned j = 0; j < NUM_CHANNELS; j++) {
+        adaptiveSamples[j] = config.local.adc[j].samples;
+    }
+}
+
+void resetStatistics()
+{
+    memset(statistics, 0, sizeof(statistics));
+}
+
+void receiveEvent(int countToRead)
+{
+    // Reset transfer, so that no stale data is read.
+    transfer.length = 0;
+
+    // A single byte is a command. It is queued for the main loop, because
+    // commands can take long (e.g. communicating with the children or writing
+    // the EEPROM).
+    if (countToRead == 1) {
+        uint8_t command = Wire.read();
+
+        if (command < WATER_SENSOR_RESET || command > WATER_SENSOR_SAMPLE || (command & 1)) {
+            return;
+        }
+
+        uint8_t head = commands.head;
+        uint8_t next = (head + 1) % COMMAND_QUEUE_SIZE;
+
+        if (next == commands.tail) {
+            _receiveStatusRegister(WATER_SENSOR_COMMAND_INDEX(command), WATER_SENSOR_STATUS_FAILED);
+            return;
+        }
+
+        commands.buffer[head] = command;
+        commands.head = next;
+
+        _receiveStatusRegister(WATER_SENSOR_COMMAND_INDEX(command), WATER_SENSOR_STATUS_PENDING);
+
+        return;
+    }
+
+    if (countToRead < 2) {
+        return;
+    }
+
+    // Read the register address.
+    uint16_t address = Wire.read() << 8;
+    address |= Wire.read();
+
+    if (address >= WATER_SENSOR_REG_SIZE) {
+        return;
+    }
+
+    // Two bytes select the registers to read. The bytes are returned when
+    // the host requests them.
+    if (countToRead == 2) {
+        transfer.address = address;
+        transfer.length = min(WATER_SENSOR_TRANSFER_SIZE, WATER_SENSOR_REG_SIZE - address);
+
+        // A register that is not kept serialized is prepared when it is
+        // selected, unless it is being prepared or was not read yet.
+        if (address >= WATER_SENSOR_REG_LEVEL_STATISTICS(0) && (selected.address != address || (selected.status != SELECTED_PENDING && selected.status != SELECTED_READY))) {
+            selected.address = address;
+            selected.status = SELECTED_PENDING;
+        }
+
+        return;
+    }
+
+    // Otherwise, it is a write of one configuration register, including its
+    // checksum. It is verified and applied by the main loop.
+    uint8_t length = countToRead - 2;
+
+    if (written.pending || length > sizeof(written.buffer) - WRITTEN_DATA) {
+        _receiveStatusRegister(WATER_SENSOR_STATUS_WRITE, WATER_SENSOR_STATUS_FAILED);
+        return;
+    }
+
+    for (unsigned i = 0; i < length; i++) {
+        written.buffer[WRITTEN_DATA + i] = Wire.read();
+    }
+
+    written.address = address;
+    written.length = length;
+    written.pending = true;
+
+    _receiveStatusRegister(WATER_SENSOR_STATUS_WRITE, WATER_SENSOR_STATUS_PENDING);
+}
+
+void requestEvent()
+{
+    uint16_t address = transfer.address;
+    uint8_t length = transfer.length;
+
+    // Every register is kept serialized or prepared in advance, so the
+    // requested bytes are only copied, an area at a time.
+    while (length) {
+        const uint8_t *data;
+        uint16_t count;
+
+        if (address < WATER_SENSOR_REG_STATUS) {
+            data = &stateRegisters[address];
+            count = WATER_SENSOR_REG_STATUS - address;
+        }
+        else if (address < WATER_SENSOR_REG_LATCHED) {
+            data = &statusRegister[address - WATER_SENSOR_REG_STATUS];
+            count = WATER_SENSOR_REG_LATCHED - address;
+        }
+        else if (address < WATER_SENSOR_REG_LEVEL_STATISTICS(0)) {
+            data = &latchedRegister[address - WATER_SENSOR_REG_LATCHED];
+            count = WATER_SENSOR_REG_LEVEL_STATISTICS(0) - address;
+        }
+        else if (address == selected.address && (selected.status == SELECTED_READY || selected.status == SELECTED_SERVED)) {
+            data = selected.buffer;
+            count = selected.length;
+            selected.status = SELECTED_SERVED;
+        }
+        else {
+            break;
+        }
+
+        count = min(count, (uint16_t)length);
+        Wire.write(data, count);
+
+        address += count;
+        length -= count;
+    }
+
+    // The checksum of all zeroes is not zero, so the rest reads as invalid.
+    while (length--) {
+        Wire.write((uint8_t)0);
+    }
+}
+
+uint8_t readConfigPins(void)
+{
+    pinMode(PIN_CONFIG_0, INPUT_PULLUP);
+    pinMode(PIN_CONFIG_1, INPUT_PULLUP);
+    pinMode(PIN_CONFIG_2, INPUT_PULLUP);
+    pinMode(PIN_CONFIG_3, INPUT_PULLUP);
+
+    return
+        (digitalRead(PIN_CONFIG_0) == HIGH ? 0 : 1) << 0 |
+        (digitalRead(PIN_CONFIG_1) == HIGH ? 0 : 1) << 1 |
+        (digitalRead(PIN_CONFIG_2) == HIGH ? 0 : 1) << 2 |
+        (digitalRead(PIN_CONFIG_3) == HIGH ? 0 : 1) << 3;
+}
+
+void setupParent()
+{
+    Wire.onRequest(requestEvent);
+    Wire.onReceive(receiveEvent);
+    Wire.begin(0x70);
+
+    // The children are only accessed through the master, so the bus needs no
+    // buffers.
+    Wire2.setDelay_us(5);
+    Wire2.setTimeout(50);
+    Wire2.begin();
+
+    childSensor.setWire(&Wire2);
+}
+
+void setupChild()
+{
+    Wire.onRequest(requestEvent);
+    Wire.onReceive(receiveEvent);
+    Wire.begin(SENSOR_ADDRESS(info.index));
+
+    // Respond to the general call address as well, so that the parent can
+    // send commands to all children at once.
+    TWAR |= _BV(TWGCE);
+}
+
+// Send a command to all children at once. It completes in the background,
+// once all children executed it (see finishCommand()).
+int commandChildren(uint8_t command)
+{
+    if (info.children == 0) {
+        return 0;
+    }
+
+    // The count of received commands of every child is read first.
+    _setOperationRegister(WATER_SENSOR_REG_STATUS, WATER_SENSOR_REG_STRIDE(WATER_SENSOR_STATUS_SIZE));
+    _startOperation(OPERATION_COUNT, command, WATER_SENSOR_COMMAND_INDEX(command), _BV(info.children) - 1);
+
+    return COMMAND_PENDING;
+}
+
+int resetChildren()
+{
+    if (info.children == 0) {
+        return 0;
+    }
+
+    // The children are detected first, by reading their info register.
+    _setOperationRegister(WATER_SENSOR_REG_INFO, WATER_SENSOR_REG_STRIDE(WATER_SENSOR_INFO_SIZE));
+    _startOperation(OPERATION_DETECT, WATER_SENSOR_RESET, WATER_SENSOR_COMMAND_INDEX(WATER_SENSOR_RESET), _BV(info.children) - 1);
+
+    return COMMAND_PENDING;
+}
+
+int enableChildren()
+{
+    // The children hold their own configuration, which the host writes
+    // through the parent, so they only have to be enabled. All of them are
+    // enabled at once.
+    return commandChildren(WATER_SENSOR_ENABLE);
+}
+
+void finishRound()
+{
+    // The state is published when the local sensors and all children are
+    // read, so that it is computed from samples that were taken at the same
+    // time.
+    if (!polling.active || latching || polling.child < info.children) {
+        return;
+    }
+
+    polling.active = false;
+
+    updateState();
+    adaptInterval();
+    publishStateRegisters();
+}
+
+void readChildren();
+
+void nextChild()
+{
+    polling.attempts = 0;
+    polling.child++;
+
+    finishRound();
+
+    // Continue with the next child, if the slice allows.
+    readChildren();
+}
+
+void readChild(int result, const water_sensor_snapshot_t *snapshot, void *arg)
+{
+    unsigned i = (uintptr_t)arg;
+
+    polling.busy = false;
+
+    // The round may have been abandoned while the child was read.
+    if (!polling.active || i != polling.child) {
+        return;
+    }
+
+    if (result != WATER_SENSOR_OK) {
+        state.errors |= 1 << WATER_SENSOR_INFO_ERRORS_READ;
+        state.context = 1 + i;
+        nextChild();
+        return;
+    }
+
+    // Until the latch counter matches, the child did not latch the sample
+    // yet, and it is read again in the next slot. A child that missed a
+    // sample command never matches, so eventually its counter is taken over.
+    if (snapshot->latch != (state.sensors[1 + i].latch & WATER_SENSOR_SNAPSHOT_LATCH_MASK)) {
+        if (polling.attempts >= UPDATE_ATTEMPTS) {
+            state.errors |= 1 << WATER_SENSOR_INFO_ERRORS_READ;
+            state.context = 1 + i;
+            state.sensors[1 + i].latch = snapshot->latch;
+            nextChild();
+        }
+        else {
+            polling.slice = UPDATE_SLICE;
+        }
+
+        return;
+    }
+
+    for (unsigned j = 0; j < NUM_CHANNELS; j++) {
+        uint16_t lastValue = state.sensors[1 + i].adc[j].value;
+        bool tracking = state.sensors[1 + i].adc[j].valid && snapshot->level[j].valid;
+
+        if (tracking) {
+            trackChange(lastValue, snapshot->level[j].value, config.sensors[1 + i].adc[j].offset);
+        }
+
+        // The minimum and maximum of the child are those of the values that
+        // the parent publishes.
+        state.sensors[1 + i].adc[j].value = snapshot->level[j].value;
+        state.sensors[1 + i].adc[j].valid = snapshot->level[j].valid;
+
+        updateChannel(1 + i, j, true);
+
+        // The children are calibrated by the parent, which owns the offsets
+        // that the level is determined with.
+        if (tracking) {
+            calibrateChannel(1 + i, j, lastValue);
+        }
+    }
+
+    if (state.sensors[1 + i].temperature.value != snapshot->temperature.value || state.sensors[1 + i].temperature.valid != snapshot->temperature.valid) {
+        state.changedSensors |= _BV(1 + i);
+    }
+
+    state.sensors[1 + i].temperature.value = snapshot->temperature.value;
+    state.sensors[1 + i].temperature.valid = snapshot->temperature.valid;
+
+    state.sensors[1 + i].updated = millis();
+
+    // The state is updated as the data of every child arrives, so that the
+    // work is spread over the round. It is published when the round is
+    // finished.
+    updateState();
+
+    nextChild();
+}
+
+void sampledChildren(int result, const uint8_t *data, size_t length, void *arg)
+{
+    (void)data;
+    (void)length;
+    (void)arg;
+
+    // The round may have been abandoned in the meantime.
+    if (!polling.active) {
+        return;
+    }
+
+    if (result == WIRE_MASTER_OK) {
+        for (unsigned i = 0; i < info.children; i++) {
+            state.sensors[1 + i].latch++;
+        }
+    }
+
+    // The local sensors are sampled right after the children.
+    sample();
+}
+
+void sampleChildren()
+{
+    polling.child = 0;
+    polling.attempts = 0;
+    polling.slice = UPDATE_SLICE;
+    polling.active = true;
+
+    // All children sample when they receive the sample command on the
+    // general call address, after which sampledChildren() is called.
+    if (wireMaster.submit(&sampleTransfer) != WIRE_MASTER_OK) {
+        sample();
+    }
+}
+
+void readChildren()
+{
+    // Up to UPDATE_SLICE children are read per slot, so that the time spent
+    // per slot does not depend on the number of children. Reading is
+    // asynchronous, and readChild() is called once the latched sample is
+    // read, after which the next child is read.
+    if (!polling.active || polling.busy || polling.child >= info.children || polling.slice >= UPDATE_SLICE) {
+        return;
+    }
+
+    unsigned i = polling.child;
+
+    // Data of a child that could not be read for some time is stale. Its
+    // channels and temperature no longer count for the level and temperature.
+    if (millis() - state.sensors[1 + i].updated > UPDATE_TIMEOUT(state.interval)) {
+        for (unsigned j = 0; j < NUM_CHANNELS; j++) {
+            state.sensors[1 + i].adc[j].valid = false;
+
+            updateChannel(1 + i, j, false);
+        }
+
+        state.sensors[1 + i].temperature.valid = false;
+
+        state.changedSensors |= _BV(1 + i);
+    }
+
+    polling.attempts++;
+    polling.slice++;
+
+    childSensor.setAddress(SENSOR_ADDRESS(1 + i));
+
+    if (childSensor.readLatchedAsync(&wireMaster, readChild, (void *)(uintptr_t)i) != WATER_SENSOR_OK) {
+        state.errors |= 1 << WATER_SENSOR_INFO_ERRORS_READ;
+        state.context = 1 + i;
+        nextChild();
+        return;
+    }
+
+    polling.busy = true;
+}
+
+int zeroChildren()
+{
+    return commandChildren(WATER_SENSOR_ZERO);
+}
+
+int reset()
+{
+    state.enabled = false;
+    state.errors = 0;
+    state.context = 0;
+    state.interval = UPDATE_INTERVAL;
+    state.changing = false;
+    state.changedChannels = UINT32_MAX;
+    state.changedSensors = UINT8_MAX;
+    state.zeroedChannels = UINT32_MAX;
+    state.zeroedSensors = UINT8_MAX;
+
+    // A round in progress is abandoned, and so is a sample that is not latched
+    // yet. A read of a child that is still outstanding is ignored when it
+    // completes.
+    polling.active = false;
+    polling.child = 0;
+    polling.attempts = 0;
+    polling.slice = 0;
+
+    if (latching) {
+        latching = false;
+        completeCommand(WATER_SENSOR_SAMPLE, 1);
+    }
+
+    config.minInterval = UPDATE_INTERVAL;
+    config.maxInterval = UPDATE_INTERVAL_MAX;
+    config.noiseTarget = 0;
+    config.sampleBudget = SAMPLES_BUDGET;
+    config.compensationTemperature = COMPENSATION_TEMPERATURE;
+    config.interpolation = WATER_SENSOR_INTERPOLATION_OFF;
+
+    for (unsigned j = 0; j < NUM_CHANNELS; j++) {
+        config.local.adc[j].samples = 60;
+        config.local.adc[j].filter = WATER_SENSOR_FILTER_EMA;
+        config.local.adc[j].alpha = 2;
+        config.local.adc[j].period = 1;
+        config.local.adc[j].compensation = WATER_SENSOR_COMPENSATION_OFF;
+        config.local.adc[j].coefficient = 0;
+    }
+
+    config.local.temperature.enabled = true;
+    config.local.temperature.filter = WATER_SENSOR_FILTER_EMA;
+    config.local.temperature.alpha = 2;
+    config.local.temperature.period = TEMPERATURE_PERIOD;
+    config.local.temperature.reference = 5000;
+
+    for (unsigned i = 0; i < NUM_SENSORS; i++) {
+        for (unsigned j = 0; j < NUM_CHANNELS; j++) {
+            config.sensors[i].adc[j].enabled = true;
+            config.sensors[i].adc[j].resolution = 0;
+            config.sensors[i].adc[j].calibration = WATER_SENSOR_CALIBRATION_OFF;
+            config.sensors[i].adc[j].dry = 0;
+            config.sensors[i].adc[j].wet = 0;
+            config.sensors[i].adc[j].hysteresis = 0;
+            config.sensors[i].adc[j].debounce = 0;
+            config.sensors[i].adc[j].offset = 512;
+            config.sensors[i].adc[j].level = (NUM_SENSORS * NUM_CHANNELS) - (i * NUM_SENSORS) - j;
+
+            state.sensors[i].adc[j].value = 0;
+            state.sensors[i].adc[j].valid = false;
+            state.sensors[i].adc[j].debounce = 0;
+
+            updateChannel(i, j, false);
+        }
+
+        state.sensors[i].temperature.value = 0;
+        state.sensors[i].temperature.valid = false;
+
+        state.sensors[i].latch = 0;
+    }
+
+    // The children are reset too, so that their latch counters start at the
+    // same value.
+    latch = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memset(latchedRegister, 0, WATER_SENSOR_SNAPSHOT_SIZE);
+        _seal(latchedRegister, WATER_SENSOR_SNAPSHOT_SIZE);
+    }
+
+    resetSampling();
+    resetStatistics();
+
+    regression.primed = 0;
+
+    // Detect and reset the children, in the background.
+    if (info.index == 0) {
+        return resetChildren();
+    }
+
+    return 0;
+}
+
+int enable()
+{
+    // A parent is enabled once its children are, in the background.
+    if (info.index == 0 && info.children) {
+        return enableChildren();
+    }
+
+    state.enabled = true;
+
+    return 0;
+}
+
+int load()
+{
+    uint32_t magic;
+    uint8_t checksum = 0xff;
+
+    // The configuration is verified in place, because a copy does not fit on
+    // the stack.
+    for (unsigned i = 0; i < sizeof(config_t); i++) {
+        checksum ^= EEPROM.read(i);
+    }
+
+    EEPROM.get(offsetof(config_t, magic), magic);
+
+    if (magic != CONFIG_MAGIC) {
+#ifdef DEBUG
+        Serial.println("Magic failed.");
+#endif
+        return 1;
+    }
+
+    if (checksum != EEPROM.read(sizeof(config_t))) {
+#ifdef DEBUG
+        Serial.println("Checksum failed.");
+#endif
+        return 2;
+    }
+
+    uint8_t resolution[NUM_CHANNELS];
+
+    for (unsigned j = 0; j < NUM_CHANNELS; j++) {
+        resolution[j] = config.sensors[0].adc[j].resolution;
+    }
+
+    EEPROM.get(0, config);
+
+    // Everything that is derived from the configuration is derived again,
+    // like after a reset. Values in another scale cannot be mixed with the
+    // current ones.
+    resetSampling();
+
+    for (unsigned i = 0; i < NUM_SENSORS; i++) {
+        for (unsigned j = 0; j < NUM_CHANNELS; j++) {
+            if (i == 0 && config.sensors[0].adc[j].resolution != resolution[j]) {
+                state.zeroedChannels |= _BV(j);
+            }
+
+            updateChannel(i, j, false);
+        }
+    }
+
+    state.changedChannels = UINT32_MAX;
+    state.changedSensors = UINT8_MAX;
+
+    // The children load their own configuration.
+    if (info.index == 0) {
+        return commandChildren(WATER_SENSOR_LOAD);
+    }
+
+    return 0;
+}
+
+int store()
+{
+    config.magic = CONFIG_MAGIC;
+
+    uint8_t checksum = 0xff;
+
+    for (unsigned i = 0; i < sizeof(config_t); i++) {
+        uint8_t result = ((uint8_t *)&config)[i];
+
+        // Only the changed bytes are written, which is faster and wears the
+        // EEPROM less.
+        EEPROM.update(i, result);
+        checksum ^= result;
+    }
+
+    EEPROM.update(sizeof(config_t), checksum);
+
+    // The children store their own configuration.
+    if (info.index == 0) {
+        return commandChildren(WATER_SENSOR_STORE);
+    }
+
+    return 0;
+}
+
+int calibrate()
+{
+    int result = 1;
+
+    // Every channel is calibrated from its own minimum and maximum, which
+    // become its baselines. Channels that did not see both water and air
+    // since they were zeroed are skipped.
+    for (unsigned i = 0; i < (1U + info.children); i++) {
+        for (unsigned j = 0; j < NUM_CHANNELS; j++) {
+            uint16_t min;
+            uint16_t max;
+
+            _getExtremes(i, j, &min, &max);
+
+            if (!config.sensors[i].adc[j].enabled || min > max) {
+                continue;
+            }
+
+            if ((max - min) < (CALIBRATION_CONTRAST << config.sensors[i].adc[j].resolution)) {
+                continue;
+            }
+
+            config.sensors[i].adc[j].dry = min;
+            config.sensors[i].adc[j].wet = max;
+            config.sensors[i].adc[j].offset = min + ((max - min) / 3);
+
+            updateChannel(i, j, false);
+
+            result = 0;
+        }
+    }
+
+    return result;
+}
+
+int zero()
+{
+    // The minimums and maximums are reset when the snapshots are published.
+    state.zeroedChannels = UINT32_MAX;
+    state.zeroedSensors = UINT8_MAX;
+
+    for (unsigned i = 0; i < NUM_SENSORS; i++) {
+        for (unsigned j = 0; j < NUM_CHANNELS; j++) {
+            state.sensors[i].adc[j].valid = false;
+
+            updateChannel(i, j, false);
+        }
+    }
+
+    if (info.index == 0) {
+        return zeroChildren();
+    }
+
+    return 0;
+}
+
+int sample()
+{
+    // The sample is latched when sampling completes, which is also when the
+    // command completes.
+    startSampling();
+    latching = true;
+
+    return COMMAND_PENDING;
+}
+
+int execute(uint8_t command)
+{
+    switch (command) {
+        case WATER_SENSOR_RESET:
+            return reset();
+        case WATER_SENSOR_ENABLE:
+            return enable();
+        case WATER_SENSOR_LOAD:
+            return load();
+        case WATER_SENSOR_STORE:
+            return store();
+        case WATER_SENSOR_CALIBRATE:
+            return calibrate();
+        case WATER_SENSOR_ZERO:
+            return zero();
+        case WATER_SENSOR_SAMPLE:
+            return sample();
+    }
+
+    return 1;
+}
+
+bool isQueued(uint8_t command)
+{
+    for (uint8_t i = commands.tail; i != commands.head; i = (i + 1) % COMMAND_QUEUE_SIZE) {
+        if (commands.buffer[i] == command) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void completeCommand(uint8_t command, int result)
+{
+    // If the same command is queued again, it is still pending.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (!isQueued(command)) {
+            updateStatusRegister(WATER_SENSOR_COMMAND_INDEX(command), result == 0 ? WATER_SENSOR_STATUS_DONE : WATER_SENSOR_STATUS_FAILED);
+        }
+    }
+}
+
+// Complete a command, once the children executed it. If detecting them
+// failed, a reset did not reach the children.
+void finishCommand(uint8_t command, int result, bool detecting)
+{
+    switch (command) {
+        case WATER_SENSOR_RESET:
+            if (result != 0) {
+                state.errors |= 1 << (detecting ? WATER_SENSOR_INFO_ERRORS_INIT : WATER_SENSOR_INFO_ERRORS_RESET);
+                state.context = result;
+            }
+            break;
+        case WATER_SENSOR_ENABLE:
+            if (result != 0) {
+                state.errors |= 1 << WATER_SENSOR_INFO_ERRORS_ENABLE;
+                state.context = result;
+            }
+            else {
+                state.enabled = true;
+            }
+            break;
+        case WATER_SENSOR_ZERO:
+            if (result != 0) {
+                state.errors |= 1 << WATER_SENSOR_INFO_ERRORS_ZERO;
+                state.context = result;
+            }
+            break;
+    }
+
+    completeCommand(command, result);
+    publishStateRegisters();
+}
+
+void setup()
+{
+    // The serial port (and its buffers) is only used for debugging, because
+    // the RAM is needed for the registers.
+#ifdef DEBUG
+    Serial.begin(9600);
+#endif
+
+    // Read the configuration pins.
+    uint8_t pins = readConfigPins();
+
+    info.id = WATER_SENSOR_ID;
+
+    if (pins & 0x08) {
+        info.index = 0;
+        info.children = pins & 0x07;
+    }
+    else {
+        info.index = (pins & 0x07) + 1;
+        info.children = 0;
+    }
+
+#ifdef DEBUG
+    Serial.print("Pins: index = ");
+    Serial.print(info.index, DEC);
+    Serial.print(", children = ");
+    Serial.println(info.children, DEC);
+#endif
+
+    // Configure sensor as parent or child.
+    if (info.index == 0) {
+        setupParent();
+
+        // Add a delay, because when powering all sensors at the same time,
+        // it is likely that the child sensors are still powering up.
+        delay(250);
+    }
+    else {
+        setupChild();
+    }
+
+    // Setup sampling of the local sensors.
+    samplerBegin();
+
+    // Setup timers
+    readTimer.start(UPDATE_INTERVAL, AsyncDelay::MILLIS);
+
+    if (info.index == 0) {
+        updateTimer.start(UPDATE_INTERVAL, AsyncDelay::MILLIS);
+        slotTimer.start(UPDATE_SLOT, AsyncDelay::MILLIS);
+    }
 
-    for (unsigned i = 0; i < info.children; i++) {
-        if (waterSensor[i].readInfo(&response) != WATER_SENSOR_OK) {
-            result = i + 1;
-            continue;
-        }
+    // Initialize config and state.
+    reset();
 
-        if (response.id != WATER_SENSOR_ID) {
-            result = i + 1;
-            continue;
-        }
+    for (unsigned i = 0; i < WATER_SENSOR_STATUS_SIZE; i++) {
+        updateStatusRegister(i, WATER_SENSOR_STATUS_IDLE);
     }
 
-    return result;
+    publishStateRegisters();
 }
 
-int resetChildren()
+// Returns true if a slot is due for sampling in this interval.
+static bool _isDue(unsigned slot, uint8_t period)
 {
-    int result = 0;
-
-    for (unsigned i = 0; i < info.children; i++) {
-        if (waterSensor[i].reset() != WATER_SENSOR_OK) {
-            result = i + 1;
-            continue;
-        }
+    if (countdown[slot] > 0) {
+        countdown[slot]--;
+        return false;
     }
 
-    return result;
+    countdown[slot] = period > 0 ? period - 1 : 0;
+
+    return true;
 }
 
-int enableChildren()
+void startSampling()
 {
-    int result = 0;
+    uint16_t samples[SAMPLER_SLOTS];
+    uint16_t total = 0;
 
-    for (unsigned i = 0; i < info.children; i++) {
-        for (unsigned j = 0; j < NUM_CHANNELS; j++) {
-            water_sensor_level_config_t request;
+    for (unsigned j = 0; j < NUM_CHANNELS; j++) {
+        samples[j] = 0;
 
-            request.enabled = config.sensors[i + 1].adc[j].enabled ? 1 : 0;
-            request.samples = config.sensors[i + 1].adc[j].samples;
-            request.alpha = config.sensors[i + 1].adc[j].alpha;
-            request.offset = config.sensors[i + 1].adc[j].offset;
-            request.level = config.sensors[i + 1].adc[j].level;
+        if (config.sensors[0].adc[j].enabled && _isDue(j, config.local.adc[j].period)) {
+            samples[j] = config.noiseTarget ? adaptiveSamples[j] : config.local.adc[j].samples;
+            total += samples[j];
+        }
+    }
 
-            if (waterSensor[i].writeLevelConfig(j, &request) != WATER_SENSOR_OK) {
-                result = i + 1;
-                continue;
+    // Noisy channels may not exceed the budget, so they are all scaled down.
+    if (config.noiseTarget && config.sampleBudget && total > config.sampleBudget) {
+        for (unsigned j = 0; j < NUM_CHANNELS; j++) {
+            if (samples[j]) {
+                samples[j] = ((uint32_t)samples[j] * config.sampleBudget) / total;
+                samples[j] = samples[j] ? samples[j] : 1;
             }
         }
+    }
 
-        water_sensor_temperature_config_t request;
-
-        request.enabled = config.sensors[i + 1].temperature.enabled ? 1 : 0;
-        request.alpha = config.sensors[i + 1].temperature.alpha;
-        request.reference = config.sensors[i + 1].temperature.reference;
+    samples[SAMPLER_SLOT_TEMPERATURE] = 0;
 
-        if (waterSensor[i].writeTemperatureConfig(0, &request) != WATER_SENSOR_OK) {
-            result = i + 1;
-            continue;
-        }
+    if (config.local.temperature.enabled && _isDue(SAMPLER_SLOT_TEMPERATURE, config.local.temperature.period)) {
+        samples[SAMPLER_SLOT_TEMPERATURE] = 1;
     }
 
-    return result;
+    samplerStart(samples);
 }
 
-int readChildren()
+void trackChange(uint16_t last, uint16_t value, uint16_t offset)
 {
-    int result = 0;
-
-    for (unsigned i = 0; i < info.children; i++) {
-        // Read raw level.
-        for (unsigned j = 0; j < NUM_CHANNELS; j++) {
-            water_sensor_level_raw_t response;
-
-            if (waterSensor[i].readLevelRaw(j, &response) != WATER_SENSOR_OK) {
-                result = 1 + i;
-                continue;
-            }
-
-            state.sensors[1 + i].adc[j].value = response.value;
-            state.sensors[1 + i].adc[j].min = response.min;
-            state.sensors[1 + i].adc[j].max = response.max;
-            state.sensors[1 + i].adc[j].valid = response.valid;
-        }
-
-        // Read raw temperature.
-        water_sensor_temperature_raw_t response;
-
-        if (waterSensor[i].readTemperatureRaw(0, &response) != WATER_SENSOR_OK) {
-            result = 1 + i;
-            continue;
-        }
+    uint16_t delta = value > last ? value - last : last - value;
 
-        state.sensors[1 + i].temperature.value = response.value;
-        state.sensors[1 + i].temperature.min = response.min;
-        state.sensors[1 + i].temperature.max = response.max;
-        state.sensors[1 + i].temperature.valid = response.valid;
+    if (delta > (offset >> UPDATE_CHANGE_SHIFT)) {
+        state.changing = true;
     }
-
-    return result;
 }
 
-int zeroChildren()
+void adaptInterval()
 {
-    int result = 0;
+    // Sample as fast as possible while the channels change, and back off
+    // gradually while they are stable.
+    uint32_t interval = state.interval;
 
-    for (unsigned i = 0; i < info.children; i++) {
-        if (waterSensor[i].zero() != WATER_SENSOR_OK) {
-            result = 1 + i;
-            continue;
-        }
+    if (state.changing) {
+        interval = config.minInterval;
+    }
+    else {
+        interval = interval + (interval / 4) + 1;
     }
 
-    return result;
+    state.interval = constrain(interval, config.minInterval, config.maxInterval);
+    state.changing = false;
 }
 
-void reset()
+void calibrateChannel(unsigned i, unsigned j, uint16_t last)
 {
-    int result;
+    uint16_t value = state.sensors[i].adc[j].value;
+    uint8_t resolution = config.sensors[i].adc[j].resolution;
 
-    state.enabled = false;
-    state.errors = 0;
-    state.context = 0;
+    if (config.sensors[i].adc[j].calibration != WATER_SENSOR_CALIBRATION_AUTO) {
+        return;
+    }
 
-    for (unsigned i = 0; i < NUM_SENSORS; i++) {
-        for (unsigned j = 0; j < NUM_CHANNELS; j++) {
-            config.sensors[i].adc[j].enabled = true;
-            config.sensors[i].adc[j].samples = 60;
-            config.sensors[i].adc[j].alpha = 25;
-            config.sensors[i].adc[j].offset = 512;
-            config.sensors[i].adc[j].level = (NUM_SENSORS * NUM_CHANNELS) - (i * NUM_SENSORS) - j;
+    // Values in between dry and wet are expected while the channel changes,
+    // and should not pull the baselines.
+    uint16_t delta = value > last ? value - last : last - value;
 
-            state.sensors[i].adc[j].value = 0;
-            state.sensors[i].adc[j].min = UINT16_MAX;
-            state.sensors[i].adc[j].max = 0;
-            state.sensors[i].adc[j].valid = false;
-        }
+    if (delta > (config.sensors[i].adc[j].offset >> UPDATE_CHANGE_SHIFT)) {
+        return;
+    }
 
-        config.sensors[i].temperature.enabled = true;
-        config.sensors[i].temperature.alpha = 25;
-        config.sensors[i].temperature.reference = 5000;
+    uint16_t dry = config.sensors[i].adc[j].dry;
+    uint16_t wet = config.sensors[i].adc[j].wet;
+    uint16_t offset = config.sensors[i].adc[j].offset;
 
-        state.sensors[i].temperature.value = 0;
-        state.sensors[i].temperature.min = INT16_MAX;
-        state.sensors[i].temperature.max = INT16_MIN;
-        state.sensors[i].temperature.valid = false;
+    if (value <= offset) {
+        if (dry == 0) {
+            dry = value;
+        }
+        else if (value < dry) {
+            dry -= (dry - value + _BV(CALIBRATION_ATTACK) - 1) >> CALIBRATION_ATTACK;
+        }
+        else {
+            dry += (value - dry) >> CALIBRATION_DRIFT;
+        }
+    }
+    else {
+        if (wet == 0) {
+            wet = value;
+        }
+        else if (value > wet) {
+            wet += (value - wet + _BV(CALIBRATION_ATTACK) - 1) >> CALIBRATION_ATTACK;
+        }
+        else {
+            wet -= (wet - value) >> CALIBRATION_DRIFT;
+        }
     }
 
-    if (info.index == 0) {
-        // Detect children.
-        result = initChildren();
+    // The offset is only calibrated when both baselines are known, and far
+    // enough apart to tell dry from wet. It moves a limited step at a time,
+    // so that a single bad baseline cannot flip the channel at once.
+    if (dry != 0 && wet > dry && (wet - dry) >= (CALIBRATION_CONTRAST << resolution)) {
+        int32_t target = dry + ((wet - dry) / 3);
+        int32_t step = (int32_t)CALIBRATION_STEP << resolution;
 
-        if (result != 0) {
-            state.errors |= 1 << WATER_SENSOR_INFO_ERRORS_INIT;
-            state.context = result;
-            return;
-        }
+        offset += constrain(target - offset, -step, step);
+    }
 
-        // Reset children.
-        result = resetChildren();
+    if (dry != config.sensors[i].adc[j].dry || wet != config.sensors[i].adc[j].wet || offset != config.sensors[i].adc[j].offset) {
+        config.sensors[i].adc[j].dry = dry;
+        config.sensors[i].adc[j].wet = wet;
+        config.sensors[i].adc[j].offset = offset;
 
-        if (result != 0) {
-            state.errors |= 1 << WATER_SENSOR_INFO_ERRORS_RESET;
-            state.context = result;
-            return;
-        }
+        updateChannel(i, j, false);
     }
 }
 
-void enable()
+void updateChannel(unsigned i, unsigned j, bool sampled)
 {
-    int result;
+    uint32_t bit = (uint32_t)1 << ((i * NUM_CHANNELS) + j);
+    uint32_t active = state.active;
+    uint32_t wet = state.wet;
 
-    if (info.index == 0) {
-        // Enable children.
-        result = enableChildren();
+    state.invalid &= ~bit;
 
-        if (result != 0) {
-            state.errors |= 1 << WATER_SENSOR_INFO_ERRORS_ENABLE;
-            state.context = result;
-            return;
+    if (config.sensors[i].adc[j].enabled && state.sensors[i].adc[j].valid) {
+        state.active |= bit;
+    }
+    else {
+        state.active &= ~bit;
+        state.wet &= ~bit;
+
+        if (config.sensors[i].adc[j].enabled) {
+            state.invalid |= bit;
         }
     }
 
-    state.enabled = true;
-}
+    if (state.active & bit) {
+        uint16_t value = state.sensors[i].adc[j].value;
+        uint16_t offset = config.sensors[i].adc[j].offset;
+        uint16_t hysteresis = config.sensors[i].adc[j].hysteresis;
+        bool crossed;
 
-void load()
-{
-    noInterrupts();
+        // A wet channel turns dry at or below the lower threshold, and a dry
+        // channel turns wet above the upper threshold.
+        if (state.wet & bit) {
+            crossed = value <= (offset > hysteresis ? offset - hysteresis : 0);
+        }
+        else {
+            crossed = value > ((UINT16_MAX - offset) > hysteresis ? offset + hysteresis : UINT16_MAX);
+        }
 
-    config_t buffer;
-    uint8_t checksum = 0xff;
+        // A sampled channel only changes sides after the configured number of
+        // consecutive samples on the other side. Changes of the configuration
+        // apply immediately.
+        if (!crossed) {
+            state.sensors[i].adc[j].debounce = 0;
+        }
+        else if (sampled && ++state.sensors[i].adc[j].debounce < config.sensors[i].adc[j].debounce) {
+            crossed = false;
+        }
+        else {
+            state.sensors[i].adc[j].debounce = 0;
+        }
 
-    for (unsigned i = 0; i < sizeof(config_t); i++) {
-        uint8_t result = EEPROM.read(i);
+        if (crossed) {
+            state.wet ^= bit;
+        }
+    }
 
-        ((uint8_t *)&buffer)[i] = result;
-        checksum ^= result;
+    // Only a channel that changes sides, or that comes or goes, affects the
+    // level, unless it is the boundary channel that the level is interpolated
+    // with.
+    if (state.wet != wet || state.active != active || (config.interpolation && state.level.boundary == (int8_t)((i * NUM_CHANNELS) + j))) {
+        state.changedChannels |= bit;
     }
+}
 
-    if (buffer.magic != CONFIG_MAGIC) {
-        Serial.println("Magic failed.");
+// Adapt the number of samples of a level channel, so that the noise of the
+// averaged value meets the target.
+static void _adaptSamples(unsigned j, const sampler_result_t *result)
+{
+    uint32_t n = result->count[j];
+
+    if (n < 2) {
         return;
     }
 
-    if (checksum != EEPROM.read(sizeof(config_t))) {
-        Serial.println("Checksum failed.");
-        return;
+    // The sum of the squared deviations from the mean. It is computed around
+    // the truncated mean, and then corrected by the remainder of the mean.
+    // With at most WATER_SENSOR_SAMPLES_MAX samples of ten bits, all terms
+    // fit in 32 bits.
+    uint32_t mean = result->sum[j] / n;
+    uint32_t remainder = result->sum[j] - (n * mean);
+    uint32_t deviation = result->squares[j] - (mean * ((2 * result->sum[j]) - (n * mean))) - ((remainder * remainder) / n);
+
+    // The variance of the average is the variance of the samples divided by
+    // the number of samples. The target is in 1/16 counts, so the number of
+    // samples that is required is 256 * deviation / (n * target^2). A
+    // deviation that is too large to scale requires all samples anyway.
+    uint8_t samples = config.local.adc[j].samples;
+    uint32_t required = samples;
+
+    if (deviation <= (UINT32_MAX >> 8)) {
+        required = (deviation << 8) / (n * config.noiseTarget * config.noiseTarget);
     }
 
-    memcpy(&config, &buffer, sizeof(config_t));
+    // Every extra bit of resolution requires four times as many samples.
+    uint16_t minimum = 1U << (2 * config.sensors[0].adc[j].resolution);
 
-    interrupts();
-}
+    if (minimum < SAMPLES_MIN) {
+        minimum = SAMPLES_MIN;
+    }
 
-void store()
-{
-    noInterrupts();
+    if (required < minimum) {
+        required = minimum;
+    }
 
-    config.magic = CONFIG_MAGIC;
+    if (required > samples) {
+        required = samples;
+    }
 
-    uint8_t checksum = 0xff;
+    // Move halfway, so that a single noisy interval does not dominate.
+    adaptiveSamples[j] = (adaptiveSamples[j] + required + 1) / 2;
+}
 
-    for (unsigned i = 0; i < sizeof(config_t); i++) {
-        uint8_t result = ((uint8_t *)&config)[i];
+// Update the running mean and variance of the temperature, that the
+// temperature coefficients are learned from.
+static void _learnTemperature(int16_t temperature)
+{
+    int32_t x = (int32_t)temperature << 8;
 
-        EEPROM.write(i, result);
-        checksum ^= result;
+    if (!(regression.primed & _BV(SAMPLER_SLOT_TEMPERATURE))) {
+        regression.temperature = x;
+        regression.variance = 0;
+        regression.primed |= _BV(SAMPLER_SLOT_TEMPERATURE);
     }
 
-    EEPROM.write(sizeof(config_t), checksum);
-
-    interrupts();
+    // The deviation is used for the covariance of every channel.
+    regression.deviation = (x - regression.temperature) >> 8;
+    regression.temperature += (x - regression.temperature) >> COMPENSATION_WINDOW;
+    regression.variance += ((regression.deviation * regression.deviation) - regression.variance) >> COMPENSATION_WINDOW;
 }
 
-void calibrate()
+// Learn the temperature coefficient of a level channel, as the slope of the
+// regression of its values on the temperature. The slope is only computed
+// again when the temperature changed.
+static void _learnCoefficient(unsigned j, uint16_t value, bool changed)
 {
-    uint16_t min = 0;
-    uint16_t max = 0;
-
-    for (unsigned i = 0; i < (1U + info.children); i++) {
-        for (unsigned j = 0; j < NUM_CHANNELS; j++) {
-            if (!config.sensors[i].adc[j].enabled) {
-                continue;
-            }
+    int32_t x = (int32_t)value << 8;
 
-            min = state.sensors[i].adc[j].min;
-            max = state.sensors[i].adc[j].max;
-        }
+    if (!(regression.primed & _BV(j))) {
+        regression.value[j] = x;
+        regression.covariance[j] = 0;
+        regression.primed |= _BV(j);
     }
 
-    if (min > max) {
+    // The deviations are at most 16 bits (temperature) and 14 bits (value,
+    // including extra resolution), so their product fits in 32 bits.
+    int32_t deviation = (x - regression.value[j]) >> 8;
+
+    regression.value[j] += (x - regression.value[j]) >> COMPENSATION_WINDOW;
+    regression.covariance[j] += ((regression.deviation * deviation) - regression.covariance[j]) >> COMPENSATION_WINDOW;
+
+    // The slope is meaningless if the temperature did not vary enough.
+    if (!changed || regression.variance < COMPENSATION_VARIANCE) {
         return;
     }
 
-    uint16_t offset = min + ((max - min) / 3);
-
-    for (unsigned i = 0; i < (1U + info.children); i++) {
-        for (unsigned j = 0; j < NUM_CHANNELS; j++) {
-            config.sensors[i].adc[j].offset = offset;
+    int32_t covariance = regression.covariance[j];
+    int32_t variance = regression.variance;
+    uint32_t magnitude = covariance < 0 ? -covariance : covariance;
+    int32_t coefficient;
+
+    // The coefficient is covariance * 4096 / variance, limited to 16 bits.
+    // It saturates when the covariance exceeds eight times the variance.
+    // Otherwise, both are scaled down until the variance is below 2^15, so
+    // that the covariance times 4096 fits in 32 bits.
+    if ((magnitude >> 3) >= (uint32_t)variance) {
+        coefficient = covariance < 0 ? INT16_MIN : INT16_MAX;
+    }
+    else {
+        while (variance >= ((int32_t)1 << 15)) {
+            variance >>= 1;
+            covariance >>= 1;
         }
+
+        coefficient = constrain((covariance * 4096) / variance, INT16_MIN, INT16_MAX);
     }
+
+    config.local.adc[j].coefficient = coefficient;
 }
 
-void zero()
+// Compensate the value of a level channel for the temperature, relative to
+// the reference temperature.
+static uint16_t _compensate(unsigned j, uint16_t value)
 {
-    int result;
-
-    for (unsigned i = 0; i < NUM_SENSORS; i++) {
-        for (unsigned j = 0; j < NUM_CHANNELS; j++) {
-            state.sensors[i].adc[j].min = UINT16_MAX;
-            state.sensors[i].adc[j].max = 0;
-            state.sensors[i].adc[j].valid = false;
-        }
-
-        state.sensors[i].temperature.min = INT16_MAX;
-        state.sensors[i].temperature.max = INT16_MIN;
+    if (config.local.adc[j].compensation == WATER_SENSOR_COMPENSATION_OFF || !state.sensors[0].temperature.valid) {
+        return value;
     }
 
-    if (info.index == 0) {
-        result = zeroChildren();
+    int32_t delta = (int32_t)state.sensors[0].temperature.value - config.compensationTemperature;
+    int32_t result = value - (((int32_t)config.local.adc[j].coefficient * delta) >> 12);
 
-        if (result != 0) {
-            state.errors |= WATER_SENSOR_INFO_ERRORS_ZERO;
-            state.context = result;
-        }
-    }
+    return constrain(result, 0, UINT16_MAX);
 }
 
-void setup()
+void readLocal(const sampler_result_t *result)
 {
-    Serial.begin(9600);
+    bool learning = false;
+    bool changed = false;
 
-    // Read the configuration pins.
-    uint8_t pins = readConfigPins();
+    // The temperature goes first, because the level channels are compensated
+    // for it.
+    if (result->count[SAMPLER_SLOT_TEMPERATURE]) {
+        int sensorValue = result->sum[SAMPLER_SLOT_TEMPERATURE] / result->count[SAMPLER_SLOT_TEMPERATURE];
 
-    info.id = WATER_SENSOR_ID;
+        int16_t lastValue = state.sensors[0].temperature.value;
+        bool valid = state.sensors[0].temperature.valid;
+        int16_t newValue = temperatureConvert(sensorValue, config.local.temperature.reference);
 
-    if (pins & 0x08) {
-        info.index = 0;
-        info.children = pins & 0x07;
-    }
-    else {
-        info.index = (pins & 0x07) + 1;
-        info.children = 0;
-    }
+        newValue = filterApply(&filters[SAMPLER_SLOT_TEMPERATURE], config.local.temperature.filter, config.local.temperature.alpha, newValue);
 
-    Serial.print("Pins: index = ");
-    Serial.print(info.index, DEC);
-    Serial.print(", children = ");
-    Serial.println(info.children, DEC);
+        state.sensors[0].temperature.value = newValue;
+        state.sensors[0].temperature.valid = true;
 
-    // Configure sensor as parent or child.
-    if (info.index == 0) {
-        setupParent();
+        _updateStatistics(&statistics[SAMPLER_SLOT_TEMPERATURE], newValue);
 
-        // Add a delay, because when powering all sensors at the same time,
-        // it is likely that the child sensors are still powering up.
-        delay(250);
-    }
-    else {
-        setupChild();
+        if (!valid || newValue != lastValue) {
+            state.changedSensors |= _BV(0);
+            changed = true;
+        }
+
+        _learnTemperature(newValue);
+        learning = true;
     }
 
-    // Setup timers
-    readTimer.start(250, AsyncDelay::MILLIS);
+    for (unsigned j = 0; j < NUM_CHANNELS; j++) {
+        if (result->count[j]) {
+            uint16_t lastValue = state.sensors[0].adc[j].value;
+            bool valid = state.sensors[0].adc[j].valid;
+            // The average, with the extra bits of resolution (decimation).
+            uint16_t newValue = (result->sum[j] << config.sensors[0].adc[j].resolution) / result->count[j];
 
-    if (info.index == 0) {
-        updateTimer.start(250, AsyncDelay::MILLIS);
-    }
+            newValue = filterApply(&filters[j], config.local.adc[j].filter, config.local.adc[j].alpha, newValue);
 
-    // Initialize config and state.
-    reset();
-}
+            // Only a dry channel follows the temperature.
+            if (learning && config.local.adc[j].compensation == WATER_SENSOR_COMPENSATION_LEARN && _compensate(j, newValue) <= config.sensors[0].adc[j].offset) {
+                _learnCoefficient(j, newValue, changed);
+            }
 
-void readLocal()
-{
-    int pins[NUM_CHANNELS] = { A0, A1, A2, A3 };
+            newValue = _compensate(j, newValue);
 
-    for (unsigned j = 0; j < NUM_CHANNELS; j++) {
-        if (config.sensors[0].adc[j].enabled) {
-            uint32_t lastValue = state.sensors[0].adc[j].value;
-            uint32_t newValue = ADCTouch.read(
-                pins[j],
-                config.sensors[0].adc[j].samples
-            );
-
-            uint8_t alpha = config.sensors[0].adc[j].alpha;
-
-            state.sensors[0].adc[j].value = (uint16_t)(((newValue * alpha) + ((100  - alpha) * lastValue)) / 100 );
-            state.sensors[0].adc[j].min = min(state.sensors[0].adc[j].min, state.sensors[0].adc[j].value);
-            state.sensors[0].adc[j].max = max(state.sensors[0].adc[j].max, state.sensors[0].adc[j].value);
+            state.sensors[0].adc[j].value = newValue;
             state.sensors[0].adc[j].valid = true;
+
+            updateChannel(0, j, true);
+
+            if (valid) {
+                trackChange(lastValue, newValue, config.sensors[0].adc[j].offset);
+                calibrateChannel(0, j, lastValue);
+            }
+
+            if (config.noiseTarget) {
+                _adaptSamples(j, result);
+            }
+
+            _updateStatistics(&statistics[j], newValue);
         }
     }
+}
 
-    if (config.sensors[0].temperature.enabled) {
-        analogRead(PIN_TEMPERATURE);
-        int sensorValue = analogRead(PIN_TEMPERATURE);
-
-        double millivolt = sensorValue * (config.sensors[0].temperature.reference / 1000.0);
-        double tempC =  (13.582 - sqrt(pow(-13.5820, 2) + (0.01732) * (2230.8 - millivolt))) / -0.00866 + 30;
+// Number of leading zeros of a 32-bit mask, which is not zero. The builtin
+// takes an unsigned long, which is wider than 32 bits on some hosts.
+static inline uint8_t _clz32(uint32_t mask)
+{
+    return __builtin_clzl(mask) - ((sizeof(unsigned long) * 8) - 32);
+}
 
-        double temperature = tempC * 100.0;
+// Interpolate between a level and the level of the boundary channel, by how
+// far the value of the boundary channel is between its dry baseline and its
+// offset. The result has eight fractional bits, and is relative to the level.
+static int32_t _interpolate(uint8_t boundary, int16_t level)
+{
+    unsigned i = boundary / NUM_CHANNELS;
+    unsigned j = boundary % NUM_CHANNELS;
 
-        uint32_t lastValue = state.sensors[0].temperature.value;
-        uint32_t newValue = (int32_t)temperature;
+    uint16_t value = state.sensors[i].adc[j].value;
+    uint16_t dry = config.sensors[i].adc[j].dry;
+    uint16_t offset = config.sensors[i].adc[j].offset;
 
-        uint8_t alpha = config.sensors[0].temperature.alpha;
+    // The dry baseline is unknown, or the channel is not wetter than it.
+    if (dry == 0 || offset <= dry || value <= dry) {
+        return 0;
+    }
 
-        state.sensors[0].temperature.value = (uint16_t)(((newValue * alpha) + ((100  - alpha) * lastValue)) / 100);
-        state.sensors[0].temperature.min = min(state.sensors[0].temperature.min, state.sensors[0].temperature.value);
-        state.sensors[0].temperature.max = max(state.sensors[0].temperature.max, state.sensors[0].temperature.value);
-        state.sensors[0].temperature.valid = true;
+    // A dry channel can exceed its offset by its hysteresis.
+    if (value > offset) {
+        value = offset;
     }
+
+    int32_t fraction = ((int32_t)(value - dry) << 8) / (offset - dry);
+
+    return ((int32_t)config.sensors[i].adc[j].level - level) * fraction;
 }
 
 void updateState()
 {
-    bool found = false;
+    bool changed = false;
 
-    struct {
-        int16_t value = 0;
-        int8_t channel;
-        bool valid = true;
-    } level;
+    // Only the parts that are affected by a change are computed again: the
+    // level when a channel changed, and the temperature when the level or the
+    // temperature of a sensor changed.
+    if (!state.changedChannels && !state.changedSensors) {
+        return;
+    }
 
-    struct {
-        int16_t value = 0;
-        int16_t lowest;
+    if (state.changedChannels) {
+        int16_t value;
         int8_t channel;
-        int32_t average = 0;
-        uint8_t count = 0;
-        bool valid = true;
-    } temperature;
-
-    // If water is detected by channel X, then it is assumed that the channels
-    // X + 1..N detect water as well (their ADC values exceeds their offsets).
-    // If this is the case, then the level value configured for channel X is
-    // reported. If no channel detects water, then use the default level value
-    // stored in configuration.
-    for (unsigned i = 0; i < (1U + info.children); i++) {
-        for (unsigned j = 0; j < NUM_CHANNELS; j++) {
-            uint8_t channel = (i * NUM_CHANNELS) + j;
-
-            if (!config.sensors[i].adc[j].enabled) {
-                continue;
-            }
 
-            if (state.sensors[i].adc[j].value > config.sensors[i].adc[j].offset) {
-                if (!found) {
-                    level.value = config.sensors[i].adc[j].level;
-                    level.channel = channel;
-                    found = true;
-                }
+        // If water is detected by channel X, then it is assumed that the
+        // channels X + 1..N detect water as well (their ADC values exceeds
+        // their offsets). If this is the case, then the level value
+        // configured for channel X is reported. If no channel detects water,
+        // then use the default level value stored in configuration.
+        //
+        // A stuck or disconnected channel breaks this pattern, so the
+        // waterline that is reported is the one that disagrees with the
+        // fewest channels. With the waterline at channel K, the channels K..N
+        // should be wet and the others dry. Disabled channels are neither wet
+        // nor dry.
+        unsigned channels = (1U + info.children) * NUM_CHANNELS;
+        uint32_t mask = channels < 32 ? ((uint32_t)1 << channels) - 1 : UINT32_MAX;
+        uint32_t active = state.active & mask;
+        bool valid = !(state.invalid & mask);
+        uint32_t wet = state.wet & active;
+        uint32_t dry = active & ~state.wet;
+
+        // With the waterline at channel zero, all dry channels disagree.
+        // Moving it past a channel adds one if that channel is wet, and
+        // removes one if it is dry. Of equally good waterlines, the lowest one
+        // is taken, like a dry channel did before.
+        uint8_t violations = __builtin_popcountl(dry);
+        uint8_t fewest = violations;
+        uint8_t waterline = 0;
+
+        for (uint32_t bits = active; bits; bits &= bits - 1) {
+            uint8_t k = __builtin_ctzl(bits);
+
+            if (wet & ((uint32_t)1 << k)) {
+                violations++;
             }
             else {
-                found = false;
+                violations--;
+            }
+
+            if (violations <= fewest) {
+                fewest = violations;
+                waterline = k + 1;
             }
+        }
 
-            level.valid |= state.sensors[i].adc[j].valid;
+        // The current waterline is kept if it is as good, so that the level
+        // does not alternate between equally good waterlines.
+        uint32_t below = state.level.waterline < 32 ? UINT32_MAX << state.level.waterline : 0;
+
+        if ((uint8_t)(__builtin_popcountl(dry & below) + __builtin_popcountl(wet & ~below)) == fewest) {
+            waterline = state.level.waterline;
         }
-    }
 
-    if (!found) {
-        level.value = config.defaultLevel;
-        level.channel = -1;
-    }
+        below = waterline < 32 ? UINT32_MAX << waterline : 0;
 
-    // For the temperature, take a weighted average of the temperature
-    // sensors that have channels that detected water. If N out of M channels
-    // of sensor X have water detected, then the temperature value for sensor
-    // X is weigthed N times in the average.
-    for (unsigned i = 0; i < (1U + info.children); i++) {
-        if (!config.sensors[i].temperature.enabled) {
-            continue;
+        uint32_t run = wet & below;
+        uint32_t faults = (dry & below) | (wet & ~below);
+        uint8_t count = __builtin_popcountl(active);
+        uint8_t confidence = count ? ((count - fewest) * 100U) / count : 0;
+
+        int8_t boundary = -1;
+
+        if (active & ~below) {
+            boundary = 31 - _clz32(active & ~below);
         }
 
-        temperature.lowest = state.sensors[i].temperature.value;
-        temperature.valid |= state.sensors[i].temperature.valid;
+        if (run) {
+            channel = __builtin_ctzl(run);
+            value = config.sensors[channel / NUM_CHANNELS].adc[channel % NUM_CHANNELS].level;
+        }
+        else {
+            channel = -1;
+            value = config.defaultLevel;
+        }
+
+        int32_t interpolated = (int32_t)value << 8;
+
+        // A faulty boundary channel does not tell where the water is.
+        if (config.interpolation && boundary >= 0 && !(faults & ((uint32_t)1 << boundary))) {
+            interpolated += _interpolate(boundary, value);
+        }
+
+        changed = value != state.level.value || channel != state.level.channel || valid != state.level.valid || interpolated != state.level.interpolated || state.wet != state.level.wet || faults != state.level.faults || confidence != state.level.confidence;
+
+        state.level.value = value;
+        state.level.channel = channel;
+        state.level.valid = valid;
+        state.level.interpolated = interpolated;
+        state.level.boundary = boundary;
+        state.level.wet = state.wet;
+        state.level.run = run;
+        state.level.faults = faults;
+        state.level.confidence = confidence;
+        state.level.waterline = waterline;
     }
 
-    if (found) {
+    if (changed || state.changedSensors) {
+        struct {
+            int16_t value = 0;
+            int16_t lowest = 0;
+            int8_t channel;
+            int32_t average = 0;
+            uint8_t count = 0;
+            bool valid = false;
+        } temperature;
+
+        // For the temperature, take a weighted average of the temperature
+        // sensors that have channels that detected water. If N out of M
+        // channels of sensor X have water detected, then the temperature
+        // value for sensor X is weigthed N times in the average.
         for (unsigned i = 0; i < (1U + info.children); i++) {
-            for (unsigned j = 0; j < NUM_CHANNELS; j++) {
-                uint8_t channel = (i * NUM_CHANNELS) + j;
+            // A child with its temperature disabled does not report it as
+            // valid.
+            if (!state.sensors[i].temperature.valid) {
+                continue;
+            }
 
-                if (channel >= level.channel) {
-                    temperature.average += state.sensors[i].temperature.value;
-                    temperature.count++;
+            temperature.lowest = state.sensors[i].temperature.value;
+            temperature.valid |= state.sensors[i].temperature.valid;
+        }
+
+        if (state.level.run) {
+            for (unsigned i = 0; i < (1U + info.children); i++) {
+                uint8_t count = __builtin_popcountl((state.level.run >> (i * NUM_CHANNELS)) & (_BV(NUM_CHANNELS) - 1));
+
+                if (!state.sensors[i].temperature.valid) {
+                    continue;
                 }
+
+                temperature.average += (int32_t)state.sensors[i].temperature.value * count;
+                temperature.count += count;
             }
         }
 
-        temperature.value = temperature.average / temperature.count;
-        temperature.channel = (((1 + info.children) * NUM_CHANNELS) - level.channel) / NUM_CHANNELS;
-    }
-    else {
-        temperature.value = temperature.lowest;
-        temperature.channel = -1;
+        if (temperature.count) {
+            temperature.value = temperature.average / temperature.count;
+            temperature.channel = (((1 + info.children) * NUM_CHANNELS) - state.level.channel) / NUM_CHANNELS;
+        }
+        else {
+            temperature.value = temperature.lowest;
+            temperature.channel = -1;
+        }
+
+        changed |= temperature.value != state.temperature.value || temperature.channel != state.temperature.channel || temperature.valid != state.temperature.valid;
+
+        state.temperature.value = temperature.value;
+        state.temperature.channel = temperature.channel;
+        state.temperature.valid = temperature.valid;
     }
 
-    // Update the global state.
-    state.level.value = level.value;
-    state.level.channel = level.channel;
-    state.level.valid = level.valid;
+    state.changedChannels = 0;
+    state.changedSensors = 0;
 
-    state.temperature.value = temperature.value;
-    state.temperature.channel = temperature.channel;
-    state.temperature.valid = temperature.valid;
+    if (changed) {
+        state.changes++;
+    }
 }
 
 void loop()
 {
     int result;
+    const sampler_result_t *samples;
+
+    // Advance the transfers to the children, and the operation on them.
+    wireMaster.poll();
+    pollChildren();
+
+    // Apply configuration written by the host. Writes, fetches and commands
+    // wait for the operation on the children in progress, one at a time.
+    if (written.pending && operation.phase == OPERATION_IDLE) {
+        applyWrittenRegister();
+    }
+
+    // Prepare the register that the host selected.
+    if (selected.status == SELECTED_PENDING) {
+        prepareSelected();
+    }
+
+    // Execute the commands queued by the host, in order. Configuration that
+    // is written while a command is pending is applied before executing it,
+    // so the host should wait for a command to complete before writing
+    // configuration that the command should not affect.
+    while (commands.tail != commands.head && operation.phase == OPERATION_IDLE) {
+        uint8_t command = commands.buffer[commands.tail];
+        commands.tail = (commands.tail + 1) % COMMAND_QUEUE_SIZE;
+
+        result = execute(command);
+
+        // Commands can change any part of the configuration and state,
+        // including the registers of the children.
+        state.changedChannels = UINT32_MAX;
+        state.changedSensors = UINT8_MAX;
+
+        selected.status = SELECTED_IDLE;
+
+        publishStateRegisters();
+
+        // Some commands complete in the background.
+        if (result != COMMAND_PENDING) {
+            completeCommand(command, result);
+        }
+    }
 
-    // Update the local sensors.
+    // Start sampling the local sensors. An enabled parent samples them at the
+    // start of every round instead, together with the children.
     if (readTimer.isExpired()) {
-        readLocal();
+        if ((info.index != 0 || !state.enabled) && !samplerIsBusy()) {
+            startSampling();
+        }
 
         // Reset timer.
-        readTimer.repeat();
+        readTimer.start(state.interval, AsyncDelay::MILLIS);
     }
 
-    // Update the remote sensors.
-    if (info.index == 0) {
-        if (updateTimer.isExpired()) {
-            if (state.enabled) {
-                result = readChildren();
+    // Update the local sensors once they are sampled.
+    samples = samplerRead();
 
-                if (result != 0) {
-                    state.errors |= 1 << WATER_SENSOR_INFO_ERRORS_READ;
-                    state.context = result;
-                }
+    if (samples) {
+        readLocal(samples);
+
+        if (latching) {
+            latching = false;
+
+            updateLatchedRegister();
+            completeCommand(WATER_SENSOR_SAMPLE, 0);
+            finishRound();
+        }
 
-                updateState();
+        // An enabled parent updates the state, adapts the interval and
+        // publishes the state once every round, so that the published
+        // snapshots are of the same round.
+        if (info.index != 0 || !state.enabled) {
+            updateState();
+            adaptInterval();
+            publishStateRegisters();
+        }
+    }
+
+    // Update the remote sensors.
+    if (info.index == 0 && state.enabled) {
+        if (updateTimer.isExpired()) {
+            // A slow child can make a round take longer than the interval,
+            // in which case the next round starts late.
+            if (!polling.active) {
+                sampleChildren();
+                updateTimer.start(state.interval, AsyncDelay::MILLIS);
             }
+        }
+
+        if (slotTimer.isExpired()) {
+            polling.slice = 0;
+            readChildren();
 
             // Reset timer.
-            updateTimer.repeat();
+            slotTimer.repeat();
         }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,165 @@
+#include "sampler.h"
+
+#include <Arduino.h>
+#include <util/atomic.h>
+
+#include "main.h"
+
+// Reference voltage (AVcc) and the input connected to ground.
+#define SAMPLER_REFERENCE _BV(REFS0)
+#define SAMPLER_MUX_GND 0x0f
+
+enum {
+    PHASE_CHARGE,
+    PHASE_SETTLE,
+    PHASE_MEASURE,
+};
+
+// Sampler state, shared with the ADC interrupt. The main loop only accesses
+// it when the sampler is not busy, or with interrupts disabled.
+static struct {
+    uint16_t samples[SAMPLER_SLOTS];
+    sampler_result_t result;
+    uint8_t slot;
+    uint8_t phase;
+    volatile bool busy;
+    volatile bool done;
+} sampler;
+
+// Configure the current slot, or the next one that has samples to take.
+// Returns false if there are no more slots.
+static bool _selectSlot()
+{
+    while (sampler.slot < SAMPLER_SLOTS && sampler.samples[sampler.slot] == 0) {
+        sampler.slot++;
+    }
+
+    if (sampler.slot == SAMPLER_SLOTS) {
+        return false;
+    }
+
+    if (sampler.slot == SAMPLER_SLOT_TEMPERATURE) {
+        // The first conversion after switching the input is discarded.
+        ADMUX = SAMPLER_REFERENCE | PIN_TEMPERATURE;
+        sampler.phase = PHASE_SETTLE;
+    }
+    else {
+        // Charge the electrode using the pull-up, while the sample and hold
+        // capacitor is discharged by converting ground.
+        PORTC |= _BV(sampler.slot);
+        ADMUX = SAMPLER_REFERENCE | SAMPLER_MUX_GND;
+        sampler.phase = PHASE_CHARGE;
+    }
+
+    return true;
+}
+
+ISR(ADC_vect)
+{
+    uint8_t slot = sampler.slot;
+
+    switch (sampler.phase) {
+        case PHASE_CHARGE:
+        {
+            // Stop charging, and let the electrode share its charge with the
+            // sample and hold capacitor. The conversion measures the result.
+            PORTC &= ~_BV(slot);
+            ADMUX = SAMPLER_REFERENCE | slot;
+            sampler.phase = PHASE_MEASURE;
+            break;
+        }
+        case PHASE_SETTLE:
+        {
+            sampler.phase = PHASE_MEASURE;
+            break;
+        }
+        case PHASE_MEASURE:
+        {
+            uint16_t value = ADC;
+
+            sampler.result.sum[slot] += value;
+            sampler.result.squares[slot] += (uint32_t)value * value;
+            sampler.result.count[slot]++;
+
+            if (sampler.result.count[slot] < sampler.samples[slot]) {
+                if (slot != SAMPLER_SLOT_TEMPERATURE) {
+                    PORTC |= _BV(slot);
+                    ADMUX = SAMPLER_REFERENCE | SAMPLER_MUX_GND;
+                    sampler.phase = PHASE_CHARGE;
+                }
+            }
+            else {
+                sampler.slot++;
+
+                if (!_selectSlot()) {
+                    sampler.busy = false;
+                    sampler.done = true;
+                    return;
+                }
+            }
+
+            break;
+        }
+    }
+
+    ADCSRA |= _BV(ADSC);
+}
+
+void samplerBegin()
+{
+    // The electrodes are inputs, of which only the pull-up is toggled.
+    DDRC &= ~(_BV(NUM_CHANNELS) - 1);
+    PORTC &= ~(_BV(NUM_CHANNELS) - 1);
+
+    // Enable the ADC with interrupts, at the same clock as the Arduino core.
+    ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+}
+
+void samplerStart(const uint16_t samples[SAMPLER_SLOTS])
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // A sampling round that is in progress is restarted. Its conversion
+        // must complete first, so that it is not mistaken for the new one.
+        while (ADCSRA & _BV(ADSC));
+
+        ADCSRA |= _BV(ADIF);
+        PORTC &= ~(_BV(NUM_CHANNELS) - 1);
+
+        for (unsigned i = 0; i < SAMPLER_SLOTS; i++) {
+            sampler.samples[i] = samples[i];
+            sampler.result.sum[i] = 0;
+            sampler.result.squares[i] = 0;
+            sampler.result.count[i] = 0;
+        }
+
+        sampler.slot = 0;
+        sampler.done = false;
+
+        if (_selectSlot()) {
+            sampler.busy = true;
+            ADCSRA |= _BV(ADSC);
+        }
+        else {
+            sampler.busy = false;
+            sampler.done = true;
+        }
+    }
+}
+
+bool samplerIsBusy()
+{
+    return sampler.busy;
+}
+
+const sampler_result_t *samplerRead()
+{
+    if (!sampler.done) {
+        return NULL;
+    }
+
+    // The sampler is idle when done, so the result is not changed until
+    // sampling is started again.
+    sampler.done = false;
+
+    return &sampler.result;
+}
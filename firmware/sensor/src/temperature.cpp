@@ -0,0 +1,64 @@
+#include "temperature.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+// Host builds (the unit tests) keep the table in RAM.
+#define PROGMEM
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#endif
+
+// The temperature sensor (LMT86) output is converted using a lookup table
+// from millivolts to centi-degrees, with one entry per TABLE_STEP millivolts.
+// Between entries, the value is interpolated linearly. The table is computed
+// at compile time from the transfer function in the datasheet, so that no
+// floating point math is needed at runtime.
+#define TABLE_STEP 64
+#define TABLE_SIZE 97
+
+// Square root using Newton's method, that can be evaluated at compile time.
+static constexpr double _sqrt(double x, double guess, unsigned iterations)
+{
+    return iterations == 0 ? guess : _sqrt(x, 0.5 * (guess + (x / guess)), iterations - 1);
+}
+
+static constexpr int16_t _centiDegrees(double millivolt)
+{
+    return (int16_t)(((13.582 - _sqrt((13.582 * 13.582) + (0.01732 * (2230.8 - millivolt)), 16.0, 8)) / -0.00866 + 30) * 100.0);
+}
+
+// Expand the table entries from a list of indices.
+template<unsigned... I>
+struct Table {
+    static const int16_t values[sizeof...(I)];
+};
+
+template<unsigned... I>
+const int16_t Table<I...>::values[sizeof...(I)] PROGMEM = { _centiDegrees(I * TABLE_STEP)... };
+
+template<unsigned N, unsigned... I>
+struct MakeTable : MakeTable<N - 1, N - 1, I...> {};
+
+template<unsigned... I>
+struct MakeTable<0, I...> {
+    typedef Table<I...> type;
+};
+
+typedef MakeTable<TABLE_SIZE>::type table;
+
+int16_t temperatureConvert(uint16_t value, uint16_t reference)
+{
+    // The voltage in microvolts, so that no precision is lost.
+    uint32_t microvolt = (uint32_t)value * reference;
+    uint32_t index = microvolt / (TABLE_STEP * 1000UL);
+
+    if (index >= TABLE_SIZE - 1) {
+        return (int16_t)pgm_read_word(&table::values[TABLE_SIZE - 1]);
+    }
+
+    int32_t a = (int16_t)pgm_read_word(&table::values[index]);
+    int32_t b = (int16_t)pgm_read_word(&table::values[index + 1]);
+    int32_t fraction = microvolt - (index * TABLE_STEP * 1000UL);
+
+    return a + (((b - a) * fraction) / (TABLE_STEP * 1000L));
+}
@@ -1,5 +1,7 @@
 #include "water_sensor.h"
 
+#include <Arduino.h>
+
 #include "assert.h"
 
 static uint8_t _checksum(const uint8_t *data, size_t length)
@@ -13,6 +15,35 @@ static uint8_t _checksum(const uint8_t *data, size_t length)
     return checksum;
 }
 
+static void _parseSnapshot(const uint8_t *buf, water_sensor_snapshot_t *out)
+{
+    uint8_t valid = buf[WATER_SENSOR_SNAPSHOT_VALID];
+
+    for (unsigned j = 0; j < WATER_SENSOR_CHANNELS; j++) {
+        const uint8_t *p = &buf[j * 6];
+
+        out->level[j].value = (p[0] << 8) | p[1];
+        out->level[j].min = (p[2] << 8) | p[3];
+        out->level[j].max = (p[4] << 8) | p[5];
+        out->level[j].valid = (valid & (1 << j)) != 0;
+    }
+
+    const uint8_t *p = &buf[WATER_SENSOR_SNAPSHOT_TEMPERATURE];
+
+    out->temperature.value = (p[0] << 8) | p[1];
+    out->temperature.min = (p[2] << 8) | p[3];
+    out->temperature.max = (p[4] << 8) | p[5];
+    out->temperature.valid = (valid & (1 << WATER_SENSOR_SNAPSHOT_VALID_TEMPERATURE)) != 0;
+
+    out->latch = (valid >> WATER_SENSOR_SNAPSHOT_LATCH_SHIFT) & WATER_SENSOR_SNAPSHOT_LATCH_MASK;
+}
+
+wire_master_transfer_t WaterSensor::_transfer;
+uint8_t WaterSensor::_reg[2];
+water_sensor_snapshot_callback_t WaterSensor::_callback;
+void *WaterSensor::_arg;
+bool WaterSensor::_busy = false;
+
 WaterSensor::WaterSensor()
 {
 }
@@ -48,7 +79,7 @@ int WaterSensor::reset()
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return wait(WATER_SENSOR_RESET);
 }
 
 int WaterSensor::enable()
@@ -57,7 +88,7 @@ int WaterSensor::enable()
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return wait(WATER_SENSOR_ENABLE);
 }
 
 int WaterSensor::load()
@@ -66,7 +97,7 @@ int WaterSensor::load()
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return wait(WATER_SENSOR_LOAD);
 }
 
 int WaterSensor::store()
@@ -75,7 +106,7 @@ int WaterSensor::store()
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return wait(WATER_SENSOR_STORE);
 }
 
 int WaterSensor::calibrate()
@@ -84,7 +115,7 @@ int WaterSensor::calibrate()
         return WATER_SENSOR_ERR_I2C;
     }
 
-    return WATER_SENSOR_OK;
+    return wait(WATER_SENSOR_CALIBRATE);
 }
 
 int WaterSensor::zero()
@@ -93,6 +124,33 @@ int WaterSensor::zero()
         return WATER_SENSOR_ERR_I2C;
     }
 
+    return wait(WATER_SENSOR_ZERO);
+}
+
+int WaterSensor::sample()
+{
+    if (cmd(WATER_SENSOR_SAMPLE) != 0) {
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    return wait(WATER_SENSOR_SAMPLE);
+}
+
+int WaterSensor::check(uint8_t cmd)
+{
+    return check_status(WATER_SENSOR_COMMAND_INDEX(cmd));
+}
+
+int WaterSensor::broadcast(SoftWire *wire, uint8_t cmd)
+{
+    /* all children respond to the general call address */
+    wire->beginTransmission(WATER_SENSOR_I2C_GENERAL_CALL);
+    wire->write(cmd);
+
+    if (wire->endTransmission() != 0) {
+        return WATER_SENSOR_ERR_I2C;
+    }
+
     return WATER_SENSOR_OK;
 }
 
@@ -102,12 +160,11 @@ int WaterSensor::readInfo(water_sensor_info_t *out)
 
     uint8_t buf[WATER_SENSOR_INFO_SIZE + 1];
 
-    if (read_reg(WATER_SENSOR_READ_INFO, buf, sizeof(buf)) != 0) {
-        return WATER_SENSOR_ERR_I2C;
-    }
+    /* the info register reads as invalid while the state is published */
+    int result = readRegister(WATER_SENSOR_REG_INFO, buf, sizeof(buf));
 
-    if (_checksum(buf, WATER_SENSOR_INFO_SIZE) != buf[6]) {
-        return WATER_SENSOR_ERR_I2C;
+    if (result != WATER_SENSOR_OK) {
+        return result;
     }
 
     out->id = buf[0];
@@ -116,6 +173,9 @@ int WaterSensor::readInfo(water_sensor_info_t *out)
     out->enabled = buf[3];
     out->errors = buf[4];
     out->context = buf[5];
+    out->sequence = (buf[6] << 8) | buf[7];
+    out->interval = (buf[8] << 8) | buf[9];
+    out->changes = (buf[10] << 8) | buf[11];
 
     return WATER_SENSOR_OK;
 }
@@ -126,17 +186,18 @@ int WaterSensor::readLevel(water_sensor_level_t *out)
 
     uint8_t buf[WATER_SENSOR_LEVEL_SIZE + 1];
 
-    if (read_reg(WATER_SENSOR_READ_LEVEL, buf, sizeof(buf)) != 0) {
+    if (read_reg(WATER_SENSOR_REG_LEVEL, buf, sizeof(buf)) != 0) {
         return WATER_SENSOR_ERR_I2C;
     }
 
-    if (_checksum(buf, WATER_SENSOR_TEMPERATURE_SIZE) != buf[4]) {
+    if (_checksum(buf, WATER_SENSOR_LEVEL_SIZE) != buf[8]) {
         return WATER_SENSOR_ERR_I2C;
     }
 
     out->value = (buf[0] << 8) | buf[1];
     out->channel = buf[2];
     out->valid = buf[3] != 0;
+    out->interpolated = ((uint32_t)buf[4] << 24) | ((uint32_t)buf[5] << 16) | ((uint32_t)buf[6] << 8) | buf[7];
 
     return WATER_SENSOR_OK;
 }
@@ -147,7 +208,7 @@ int WaterSensor::readTemperature(water_sensor_temperature_t *out)
 
     uint8_t buf[WATER_SENSOR_TEMPERATURE_SIZE + 1];
 
-    if (read_reg(WATER_SENSOR_READ_TEMPERATURE, buf, sizeof(buf)) != 0) {
+    if (read_reg(WATER_SENSOR_REG_TEMPERATURE, buf, sizeof(buf)) != 0) {
         return WATER_SENSOR_ERR_I2C;
     }
 
@@ -162,25 +223,56 @@ int WaterSensor::readTemperature(water_sensor_temperature_t *out)
     return WATER_SENSOR_OK;
 }
 
-int WaterSensor::readLevelRaw(uint8_t channel, water_sensor_level_raw_t *out)
+int WaterSensor::readWet(uint32_t *out)
 {
     assert(out != NULL);
 
-    uint8_t buf[WATER_SENSOR_LEVEL_RAW_SIZE + 1];
-    uint16_t reg = (WATER_SENSOR_READ_LEVEL_RAW << 8) | channel;
+    uint8_t buf[WATER_SENSOR_WET_SIZE + 1];
 
-    if (read_reg16(reg, buf, sizeof(buf)) != 0) {
+    if (read_reg(WATER_SENSOR_REG_WET, buf, sizeof(buf)) != 0) {
         return WATER_SENSOR_ERR_I2C;
     }
 
-    if (_checksum(buf, WATER_SENSOR_LEVEL_RAW_SIZE) != buf[7]) {
+    if (_checksum(buf, WATER_SENSOR_WET_SIZE) != buf[4]) {
         return WATER_SENSOR_ERR_I2C;
     }
 
-    out->value = (buf[0] << 8) | buf[1];
-    out->min = (buf[2] << 8) | buf[3];
-    out->max = (buf[4] << 8) | buf[5];
-    out->valid = buf[6] != 0;
+    *out = ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+
+    return WATER_SENSOR_OK;
+}
+
+int WaterSensor::readFaults(water_sensor_faults_t *out)
+{
+    assert(out != NULL);
+
+    uint8_t buf[WATER_SENSOR_FAULTS_SIZE + 1];
+
+    if (read_reg(WATER_SENSOR_REG_FAULTS, buf, sizeof(buf)) != 0) {
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    if (_checksum(buf, WATER_SENSOR_FAULTS_SIZE) != buf[5]) {
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    out->channels = ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+    out->confidence = buf[4];
+
+    return WATER_SENSOR_OK;
+}
+
+int WaterSensor::readLevelRaw(uint8_t channel, water_sensor_level_raw_t *out)
+{
+    assert(out != NULL);
+
+    water_sensor_snapshot_t snapshot;
+
+    if (readSnapshot(channel / WATER_SENSOR_CHANNELS, &snapshot) != WATER_SENSOR_OK) {
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    *out = snapshot.level[channel % WATER_SENSOR_CHANNELS];
 
     return WATER_SENSOR_OK;
 }
@@ -189,40 +281,196 @@ int WaterSensor::readTemperatureRaw(uint8_t channel, water_sensor_temperature_ra
 {
     assert(out != NULL);
 
-    uint8_t buf[WATER_SENSOR_TEMPERATURE_RAW_SIZE + 1];
-    uint16_t reg = (WATER_SENSOR_READ_TEMPERATURE_RAW << 8) | channel;
+    water_sensor_snapshot_t snapshot;
+
+    if (readSnapshot(channel, &snapshot) != WATER_SENSOR_OK) {
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    *out = snapshot.temperature;
+
+    return WATER_SENSOR_OK;
+}
+
+int WaterSensor::readSnapshot(uint8_t sensor, water_sensor_snapshot_t *out)
+{
+    return read_snapshot(WATER_SENSOR_REG_SNAPSHOT(sensor), out);
+}
+
+int WaterSensor::readSnapshotAsync(WireMaster *master, uint8_t sensor, water_sensor_snapshot_callback_t callback, void *arg)
+{
+    return read_snapshot_async(master, WATER_SENSOR_REG_SNAPSHOT(sensor), callback, arg);
+}
+
+int WaterSensor::readLatched(water_sensor_snapshot_t *out)
+{
+    return read_snapshot(WATER_SENSOR_REG_LATCHED, out);
+}
+
+int WaterSensor::readLatchedAsync(WireMaster *master, water_sensor_snapshot_callback_t callback, void *arg)
+{
+    return read_snapshot_async(master, WATER_SENSOR_REG_LATCHED, callback, arg);
+}
+
+/* The state is read in several transfers: the info register up to the wet
+   register, every snapshot and the faults. Every transfer holds whole
+   registers of one state, and the first one holds a valid info register of
+   that state. The others are of that state too if the info register still
+   holds the same sequence number after them (see readState()). */
+int WaterSensor::read_state(water_sensor_state_t *out)
+{
+    /* info, level, temperature and wet are read at once */
+    uint8_t buf[WATER_SENSOR_REG_SNAPSHOT(0) - WATER_SENSOR_REG_INFO];
 
-    if (read_reg16(reg, buf, sizeof(buf)) != 0) {
+    if (read_reg(WATER_SENSOR_REG_INFO, buf, sizeof(buf)) != 0) {
         return WATER_SENSOR_ERR_I2C;
     }
 
-    if (_checksum(buf, WATER_SENSOR_TEMPERATURE_RAW_SIZE) != buf[7]) {
+    /* the info register is invalid while a state is published */
+    if (_checksum(&buf[WATER_SENSOR_REG_INFO], WATER_SENSOR_INFO_SIZE) != buf[WATER_SENSOR_REG_INFO + WATER_SENSOR_INFO_SIZE]) {
+        return WATER_SENSOR_ERR_BUSY;
+    }
+
+    if (_checksum(&buf[WATER_SENSOR_REG_LEVEL], WATER_SENSOR_LEVEL_SIZE) != buf[WATER_SENSOR_REG_LEVEL + WATER_SENSOR_LEVEL_SIZE] ||
+        _checksum(&buf[WATER_SENSOR_REG_TEMPERATURE], WATER_SENSOR_TEMPERATURE_SIZE) != buf[WATER_SENSOR_REG_TEMPERATURE + WATER_SENSOR_TEMPERATURE_SIZE] ||
+        _checksum(&buf[WATER_SENSOR_REG_WET], WATER_SENSOR_WET_SIZE) != buf[WATER_SENSOR_REG_WET + WATER_SENSOR_WET_SIZE]) {
         return WATER_SENSOR_ERR_I2C;
     }
 
-    out->value = (buf[0] << 8) | buf[1];
-    out->min = (buf[2] << 8) | buf[3];
-    out->max = (buf[4] << 8) | buf[5];
-    out->valid = buf[6] != 0;
+    const uint8_t *p = &buf[WATER_SENSOR_REG_INFO];
+
+    out->info.id = p[0];
+    out->info.level_channels = p[1];
+    out->info.temperature_channels = p[2];
+    out->info.enabled = p[3];
+    out->info.errors = p[4];
+    out->info.context = p[5];
+    out->info.sequence = (p[6] << 8) | p[7];
+    out->info.interval = (p[8] << 8) | p[9];
+    out->info.changes = (p[10] << 8) | p[11];
+
+    p = &buf[WATER_SENSOR_REG_LEVEL];
+
+    out->level.value = (p[0] << 8) | p[1];
+    out->level.channel = p[2];
+    out->level.valid = p[3] != 0;
+    out->level.interpolated = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+
+    p = &buf[WATER_SENSOR_REG_TEMPERATURE];
+
+    out->temperature.value = (p[0] << 8) | p[1];
+    out->temperature.channel = p[2];
+    out->temperature.valid = p[3] != 0;
+
+    p = &buf[WATER_SENSOR_REG_WET];
+
+    out->wet = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+
+    if (out->info.temperature_channels > WATER_SENSOR_SENSORS) {
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    /* followed by one snapshot per sensor */
+    for (unsigned i = 0; i < out->info.temperature_channels; i++) {
+        if (readSnapshot(i, &out->snapshots[i]) != WATER_SENSOR_OK) {
+            return WATER_SENSOR_ERR_I2C;
+        }
+    }
+
+    /* and the faults */
+    if (readFaults(&out->faults) != WATER_SENSOR_OK) {
+        return WATER_SENSOR_ERR_I2C;
+    }
 
     return WATER_SENSOR_OK;
 }
 
-int WaterSensor::readConfig(water_sensor_config_t *out)
+
+int WaterSensor::readState(water_sensor_state_t *out)
 {
     assert(out != NULL);
 
-    uint8_t buf[WATER_SENSOR_CONFIG_SIZE + 1];
+    water_sensor_info_t info;
+
+    /* the state is read in multiple transfers, so it is only consistent if
+       the sensor did not publish a new state in between */
+    for (unsigned i = 0; i < WATER_SENSOR_STATE_RETRIES; i++) {
+        int result = read_state(out);
+
+        if (result == WATER_SENSOR_ERR_BUSY) {
+            delay(WATER_SENSOR_WAIT_INTERVAL);
+            continue;
+        }
+
+        if (result != WATER_SENSOR_OK) {
+            return result;
+        }
 
-    if (read_reg(WATER_SENSOR_READ_CONFIG, buf, sizeof(buf)) != 0) {
+        if (readInfo(&info) != WATER_SENSOR_OK) {
+            return WATER_SENSOR_ERR_I2C;
+        }
+
+        if (info.sequence == out->info.sequence) {
+            return WATER_SENSOR_OK;
+        }
+    }
+
+    return WATER_SENSOR_ERR_BUSY;
+}
+
+int WaterSensor::readStatus(water_sensor_status_t *out)
+{
+    assert(out != NULL);
+
+    uint8_t buf[WATER_SENSOR_STATUS_SIZE + 1];
+
+    if (read_reg(WATER_SENSOR_REG_STATUS, buf, sizeof(buf)) != 0) {
         return WATER_SENSOR_ERR_I2C;
     }
 
-    if (_checksum(buf, WATER_SENSOR_CONFIG_SIZE) != buf[2]) {
+    if (_checksum(buf, WATER_SENSOR_STATUS_SIZE) != buf[WATER_SENSOR_STATUS_SIZE]) {
         return WATER_SENSOR_ERR_I2C;
     }
 
+    /* the upper bits count the received commands */
+    for (unsigned i = 0; i < WATER_SENSOR_COMMANDS; i++) {
+        out->commands[i] = buf[i] & WATER_SENSOR_STATUS_MASK;
+    }
+
+    out->write = buf[WATER_SENSOR_STATUS_WRITE] & WATER_SENSOR_STATUS_MASK;
+
+    return WATER_SENSOR_OK;
+}
+
+int WaterSensor::readLevelStatistics(uint8_t channel, water_sensor_statistics_t *out)
+{
+    return read_statistics(WATER_SENSOR_REG_LEVEL_STATISTICS(channel), out);
+}
+
+int WaterSensor::readTemperatureStatistics(uint8_t channel, water_sensor_statistics_t *out)
+{
+    return read_statistics(WATER_SENSOR_REG_TEMPERATURE_STATISTICS(channel), out);
+}
+
+int WaterSensor::readConfig(water_sensor_config_t *out)
+{
+    assert(out != NULL);
+
+    uint8_t buf[WATER_SENSOR_CONFIG_SIZE + 1];
+
+    int result = readRegister(WATER_SENSOR_REG_CONFIG, buf, sizeof(buf));
+
+    if (result != WATER_SENSOR_OK) {
+        return result;
+    }
+
     out->default_level = (buf[0] << 8) | buf[1];
+    out->min_interval = (buf[2] << 8) | buf[3];
+    out->max_interval = (buf[4] << 8) | buf[5];
+    out->noise_target = buf[6];
+    out->sample_budget = (buf[7] << 8) | buf[8];
+    out->compensation_temperature = (buf[9] << 8) | buf[10];
+    out->interpolation = buf[11];
 
     return WATER_SENSOR_OK;
 }
@@ -235,13 +483,19 @@ int WaterSensor::writeConfig(const water_sensor_config_t *in)
 
     buf[0] = (in->default_level & 0xff00) >> 8;
     buf[1] = (in->default_level & 0x00ff) >> 0;
-    buf[2] = _checksum(buf, WATER_SENSOR_CONFIG_SIZE);
-
-    if (write_reg(WATER_SENSOR_WRITE_CONFIG, buf, sizeof(buf)) != 0) {
-        return WATER_SENSOR_ERR_I2C;
-    }
-
-    return WATER_SENSOR_OK;
+    buf[2] = (in->min_interval & 0xff00) >> 8;
+    buf[3] = (in->min_interval & 0x00ff) >> 0;
+    buf[4] = (in->max_interval & 0xff00) >> 8;
+    buf[5] = (in->max_interval & 0x00ff) >> 0;
+    buf[6] = in->noise_target;
+    buf[7] = (in->sample_budget & 0xff00) >> 8;
+    buf[8] = (in->sample_budget & 0x00ff) >> 0;
+    buf[9] = (in->compensation_temperature & 0xff00) >> 8;
+    buf[10] = (in->compensation_temperature & 0x00ff) >> 0;
+    buf[11] = in->interpolation;
+    buf[12] = _checksum(buf, WATER_SENSOR_CONFIG_SIZE);
+
+    return writeRegister(WATER_SENSOR_REG_CONFIG, buf, sizeof(buf));
 }
 
 int WaterSensor::readLevelConfig(uint8_t channel, water_sensor_level_config_t *out)
@@ -249,14 +503,11 @@ int WaterSensor::readLevelConfig(uint8_t channel, water_sensor_level_config_t *o
     assert(out != NULL);
 
     uint8_t buf[WATER_SENSOR_LEVEL_CONFIG_SIZE + 1];
-    uint16_t reg = (WATER_SENSOR_READ_LEVEL_CONFIG << 8) | channel;
 
-    if (read_reg16(reg, buf, sizeof(buf)) != 0) {
-        return WATER_SENSOR_ERR_I2C;
-    }
+    int result = readRegister(WATER_SENSOR_REG_LEVEL_CONFIG(channel), buf, sizeof(buf));
 
-    if (_checksum(buf, WATER_SENSOR_LEVEL_CONFIG_SIZE) != buf[8]) {
-        return WATER_SENSOR_ERR_I2C;
+    if (result != WATER_SENSOR_OK) {
+        return result;
     }
 
     out->enabled = buf[0] != 0;
@@ -264,6 +515,16 @@ int WaterSensor::readLevelConfig(uint8_t channel, water_sensor_level_config_t *o
     out->alpha = buf[3];
     out->offset = (buf[4] << 8) | buf[5];
     out->level = (buf[6] << 8) | buf[7];
+    out->filter = buf[8];
+    out->period = buf[9];
+    out->resolution = buf[10];
+    out->compensation = buf[11];
+    out->coefficient = (buf[12] << 8) | buf[13];
+    out->calibration = buf[14];
+    out->dry = (buf[15] << 8) | buf[16];
+    out->wet = (buf[17] << 8) | buf[18];
+    out->hysteresis = (buf[19] << 8) | buf[20];
+    out->debounce = buf[21];
 
     return WATER_SENSOR_OK;
 }
@@ -273,7 +534,6 @@ int WaterSensor::writeLevelConfig(uint8_t channel, const water_sensor_level_conf
     assert(in != NULL);
 
     uint8_t buf[WATER_SENSOR_LEVEL_CONFIG_SIZE + 1];
-    uint16_t reg = (WATER_SENSOR_WRITE_LEVEL_CONFIG << 8) | channel;
 
     buf[0] = in->enabled ? 1 : 0;
     buf[1] = (in->samples & 0xff00) >> 8;
@@ -283,13 +543,23 @@ int WaterSensor::writeLevelConfig(uint8_t channel, const water_sensor_level_conf
     buf[5] = (in->offset & 0x00ff) >> 0;
     buf[6] = (in->level & 0xff00) >> 8;
     buf[7] = (in->level & 0x00ff) >> 0;
-    buf[8] = _checksum(buf, WATER_SENSOR_LEVEL_CONFIG_SIZE);
-
-    if (write_reg16(reg, buf, sizeof(buf)) != 0) {
-        return WATER_SENSOR_ERR_I2C;
-    }
-
-    return WATER_SENSOR_OK;
+    buf[8] = in->filter;
+    buf[9] = in->period;
+    buf[10] = in->resolution;
+    buf[11] = in->compensation;
+    buf[12] = (in->coefficient & 0xff00) >> 8;
+    buf[13] = (in->coefficient & 0x00ff) >> 0;
+    buf[14] = in->calibration;
+    buf[15] = (in->dry & 0xff00) >> 8;
+    buf[16] = (in->dry & 0x00ff) >> 0;
+    buf[17] = (in->wet & 0xff00) >> 8;
+    buf[18] = (in->wet & 0x00ff) >> 0;
+    buf[19] = (in->hysteresis & 0xff00) >> 8;
+    buf[20] = (in->hysteresis & 0x00ff) >> 0;
+    buf[21] = in->debounce;
+    buf[22] = _checksum(buf, WATER_SENSOR_LEVEL_CONFIG_SIZE);
+
+    return writeRegister(WATER_SENSOR_REG_LEVEL_CONFIG(channel), buf, sizeof(buf));
 }
 
 int WaterSensor::readTemperatureConfig(uint8_t channel, water_sensor_temperature_config_t *out)
@@ -297,19 +567,18 @@ int WaterSensor::readTemperatureConfig(uint8_t channel, water_sensor_temperature
     assert(out != NULL);
 
     uint8_t buf[WATER_SENSOR_TEMPERATURE_CONFIG_SIZE + 1];
-    uint16_t reg = (WATER_SENSOR_READ_TEMPERATURE_CONFIG << 8) | channel;
 
-    if (read_reg16(reg, buf, sizeof(buf)) != 0) {
-        return WATER_SENSOR_ERR_I2C;
-    }
+    int result = readRegister(WATER_SENSOR_REG_TEMPERATURE_CONFIG(channel), buf, sizeof(buf));
 
-    if (_checksum(buf, WATER_SENSOR_TEMPERATURE_CONFIG_SIZE) != buf[4]) {
-        return WATER_SENSOR_ERR_I2C;
+    if (result != WATER_SENSOR_OK) {
+        return result;
     }
 
     out->enabled = buf[0] != 0;
     out->alpha = buf[1];
     out->reference = (buf[2] << 8) | buf[3];
+    out->filter = buf[4];
+    out->period = buf[5];
 
     return WATER_SENSOR_OK;
 }
@@ -319,21 +588,91 @@ int WaterSensor::writeTemperatureConfig(uint8_t channel, const water_sensor_temp
     assert(in != NULL);
 
     uint8_t buf[WATER_SENSOR_TEMPERATURE_CONFIG_SIZE + 1];
-    uint16_t reg = (WATER_SENSOR_WRITE_TEMPERATURE_CONFIG << 8) | channel;
 
     buf[0] = in->enabled ? 1 : 0;
     buf[1] = in->alpha;
     buf[2] = (in->reference & 0xff00) >> 8;
     buf[3] = (in->reference & 0x00ff) >> 0;
-    buf[4] = _checksum(buf, WATER_SENSOR_TEMPERATURE_CONFIG_SIZE);
+    buf[4] = in->filter;
+    buf[5] = in->period;
+    buf[6] = _checksum(buf, WATER_SENSOR_TEMPERATURE_CONFIG_SIZE);
+
+    return writeRegister(WATER_SENSOR_REG_TEMPERATURE_CONFIG(channel), buf, sizeof(buf));
+}
+
+int WaterSensor::read_snapshot(uint16_t reg, water_sensor_snapshot_t *out)
+{
+    assert(out != NULL);
+
+    uint8_t buf[WATER_SENSOR_SNAPSHOT_SIZE + 1];
+    if (read_reg(reg, buf, sizeof(buf)) != 0) {
+        return WATER_SENSOR_ERR_I2C;
+    }
 
-    if (write_reg16(reg, buf, sizeof(buf)) != 0) {
+    if (_checksum(buf, WATER_SENSOR_SNAPSHOT_SIZE) != buf[WATER_SENSOR_SNAPSHOT_SIZE]) {
         return WATER_SENSOR_ERR_I2C;
     }
 
+    _parseSnapshot(buf, out);
+
     return WATER_SENSOR_OK;
 }
 
+int WaterSensor::read_snapshot_async(WireMaster *master, uint16_t reg, water_sensor_snapshot_callback_t callback, void *arg)
+{
+    assert(master != NULL);
+    assert(callback != NULL);
+
+    /* only one asynchronous read can be outstanding, for all sensors */
+    if (_busy) {
+        return WATER_SENSOR_ERR_BUSY;
+    }
+
+    _reg[0] = (reg & 0xff00) >> 8;
+    _reg[1] = (reg & 0x00ff) >> 0;
+
+    _transfer.address = _address;
+    _transfer.writeData = _reg;
+    _transfer.writeLength = sizeof(_reg);
+    _transfer.readLength = WATER_SENSOR_SNAPSHOT_SIZE + 1;
+    _transfer.callback = on_snapshot;
+    _transfer.arg = NULL;
+
+    _callback = callback;
+    _arg = arg;
+
+    if (master->submit(&_transfer) != WIRE_MASTER_OK) {
+        return WATER_SENSOR_ERR_BUSY;
+    }
+
+    _busy = true;
+
+    return WATER_SENSOR_OK;
+}
+
+void WaterSensor::on_snapshot(int result, const uint8_t *data, size_t length, void *arg)
+{
+    (void)arg;
+
+    water_sensor_snapshot_t snapshot;
+
+    _busy = false;
+
+    if (result != WIRE_MASTER_OK || length != WATER_SENSOR_SNAPSHOT_SIZE + 1) {
+        _callback(WATER_SENSOR_ERR_I2C, NULL, _arg);
+        return;
+    }
+
+    if (_checksum(data, WATER_SENSOR_SNAPSHOT_SIZE) != data[WATER_SENSOR_SNAPSHOT_SIZE]) {
+        _callback(WATER_SENSOR_ERR_I2C, NULL, _arg);
+        return;
+    }
+
+    _parseSnapshot(data, &snapshot);
+
+    _callback(WATER_SENSOR_OK, &snapshot, _arg);
+}
+
 int WaterSensor::cmd(uint8_t cmd)
 {
     _wire->beginTransmission(_address);
@@ -341,32 +680,113 @@ int WaterSensor::cmd(uint8_t cmd)
     return _wire->endTransmission();
 }
 
-int WaterSensor::read_reg(uint8_t reg, uint8_t *data, size_t length)
+int WaterSensor::wait(uint8_t cmd)
+{
+    unsigned long timeout = cmd == WATER_SENSOR_STORE ? WATER_SENSOR_STORE_TIMEOUT : WATER_SENSOR_WAIT_TIMEOUT;
+
+    return wait_status(WATER_SENSOR_COMMAND_INDEX(cmd), timeout);
+}
+
+int WaterSensor::check_status(uint8_t index)
+{
+    uint8_t buf[WATER_SENSOR_STATUS_SIZE + 1];
+
+    if (read_reg(WATER_SENSOR_REG_STATUS, buf, sizeof(buf)) != 0) {
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    if (_checksum(buf, WATER_SENSOR_STATUS_SIZE) != buf[WATER_SENSOR_STATUS_SIZE]) {
+        return WATER_SENSOR_ERR_I2C;
+    }
+
+    uint8_t status = buf[index] & WATER_SENSOR_STATUS_MASK;
+
+    if (status == WATER_SENSOR_STATUS_DONE) {
+        return WATER_SENSOR_OK;
+    }
+    else if (status == WATER_SENSOR_STATUS_PENDING) {
+        return WATER_SENSOR_ERR_BUSY;
+    }
+
+    return WATER_SENSOR_ERR_FAILED;
+}
+
+int WaterSensor::wait_status(uint8_t index, unsigned long timeout)
 {
     int result;
+    unsigned long start = millis();
 
-    _wire->beginTransmission(_address);
-    _wire->write(uint8_t(reg));
-    result = _wire->endTransmission();
+    /* commands and writes are executed in the background, so poll until it
+       completes */
+    do {
+        result = check_status(index);
 
-    if (result != 0) {
+        if (result != WATER_SENSOR_ERR_BUSY) {
+            return result;
+        }
+
+        delay(WATER_SENSOR_WAIT_INTERVAL);
+    } while (millis() - start < timeout);
+
+    return WATER_SENSOR_ERR_TIMEOUT;
+}
+
+int WaterSensor::read_statistics(uint16_t reg, water_sensor_statistics_t *out)
+{
+    assert(out != NULL);
+
+    uint8_t buf[WATER_SENSOR_STATISTICS_SIZE + 1];
+
+    int result = readRegister(reg, buf, sizeof(buf));
+
+    if (result != WATER_SENSOR_OK) {
         return result;
     }
 
-    result = _wire->requestFrom(_address, length);
+    out->count = buf[0];
+    out->mean = ((uint32_t)buf[1] << 24) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 8) | buf[4];
+    out->variance = ((uint32_t)buf[5] << 24) | ((uint32_t)buf[6] << 16) | ((uint32_t)buf[7] << 8) | buf[8];
 
-    if (result != length) {
-        return -1;
-    }
+    return WATER_SENSOR_OK;
+}
 
-    for (unsigned i = 0; i < length; i++) {
-        data[i] = _wire->read();
+int WaterSensor::readRegister(uint16_t reg, uint8_t *data, size_t length)
+{
+    assert(data != NULL);
+
+    unsigned long start = millis();
+
+    /* a register that is prepared when it is selected (and the info register
+       while a state is published) reads with an invalid checksum until it
+       is ready, so read until it is valid */
+    do {
+        if (read_reg(reg, data, length) != 0) {
+            return WATER_SENSOR_ERR_I2C;
+        }
+
+        if (_checksum(data, length - 1) == data[length - 1]) {
+            return WATER_SENSOR_OK;
+        }
+
+        delay(WATER_SENSOR_WAIT_INTERVAL);
+    } while (millis() - start < WATER_SENSOR_WAIT_TIMEOUT);
+
+    return WATER_SENSOR_ERR_TIMEOUT;
+}
+
+int WaterSensor::writeRegister(uint16_t reg, const uint8_t *data, size_t length)
+{
+    assert(data != NULL);
+
+    if (write_reg(reg, data, length) != 0) {
+        return WATER_SENSOR_ERR_I2C;
     }
 
-    return 0;
+    /* writes are applied in the background */
+    return wait_status(WATER_SENSOR_STATUS_WRITE);
 }
 
-int WaterSensor::read_reg16(uint16_t reg, uint8_t *data, size_t length)
+int WaterSensor::read_reg(uint16_t reg, uint8_t *data, size_t length)
 {
     int result;
 
@@ -381,7 +801,7 @@ int WaterSensor::read_reg16(uint16_t reg, uint8_t *data, size_t length)
 
     result = _wire->requestFrom(_address, length);
 
-    if (result != length) {
+    if (result < 0 || (size_t)result != length) {
         return -1;
     }
 
@@ -392,19 +812,7 @@ int WaterSensor::read_reg16(uint16_t reg, uint8_t *data, size_t length)
     return 0;
 }
 
-int WaterSensor::write_reg(uint8_t reg, const uint8_t *data, size_t length)
-{
-    _wire->beginTransmission(_address);
-    _wire->write(uint8_t(reg));
-
-    for (unsigned i = 0; i < length; i++) {
-        _wire->write(data[i]);
-    }
-
-    return _wire->endTransmission();
-}
-
-int WaterSensor::write_reg16(uint16_t reg, const uint8_t *data, size_t length)
+int WaterSensor::write_reg(uint16_t reg, const uint8_t *data, size_t length)
 {
     _wire->beginTransmission(_address);
     _wire->write(uint8_t((reg & 0xff00) >> 8));
@@ -0,0 +1,149 @@
+#include "wire_master.h"
+
+#include "assert.h"
+
+WireMaster::WireMaster(SoftWire *wire)
+{
+    _wire = wire;
+    _head = 0;
+    _tail = 0;
+    _current = NULL;
+    _state = STATE_IDLE;
+    _index = 0;
+}
+
+int WireMaster::submit(wire_master_transfer_t *transfer)
+{
+    assert(transfer != NULL);
+    assert(transfer->writeLength || transfer->readLength);
+    assert(transfer->readLength <= WIRE_MASTER_BUFFER_SIZE);
+
+    uint8_t next = (_head + 1) % WIRE_MASTER_QUEUE_SIZE;
+
+    if (next == _tail) {
+        return WIRE_MASTER_ERR_FULL;
+    }
+
+    _queue[_head] = transfer;
+    _head = next;
+
+    return WIRE_MASTER_OK;
+}
+
+void WireMaster::poll()
+{
+    SoftWire::result_t result;
+
+    switch (_state) {
+        case STATE_IDLE:
+        {
+            if (_head == _tail) {
+                return;
+            }
+
+            _current = _queue[_tail];
+            _tail = (_tail + 1) % WIRE_MASTER_QUEUE_SIZE;
+
+            start();
+            break;
+        }
+        case STATE_WRITE:
+        {
+            result = _wire->llWrite(_current->writeData[_index++]);
+
+            if (result != SoftWire::ack) {
+                finish(result);
+                return;
+            }
+
+            if (_index == _current->writeLength) {
+                _wire->stop();
+
+                if (_current->readLength) {
+                    _state = STATE_READ_START;
+                }
+                else {
+                    finish(WIRE_MASTER_OK);
+                }
+            }
+
+            break;
+        }
+        case STATE_READ_START:
+        {
+            result = _wire->llStart((_current->address << 1) | SoftWire::readMode);
+
+            if (result != SoftWire::ack) {
+                finish(result);
+                return;
+            }
+
+            _index = 0;
+            _state = STATE_READ;
+            break;
+        }
+        case STATE_READ:
+        {
+            // The last byte is not acknowledged, to end the transfer.
+            bool last = (_index + 1) == _current->readLength;
+
+            result = _wire->llRead(_buffer[_index++], !last);
+
+            if (result != SoftWire::ack) {
+                finish(result);
+                return;
+            }
+
+            if (last) {
+                _wire->stop();
+                finish(WIRE_MASTER_OK);
+            }
+
+            break;
+        }
+    }
+}
+
+void WireMaster::flush()
+{
+    while (!isIdle()) {
+        poll();
+    }
+}
+
+void WireMaster::start()
+{
+    SoftWire::result_t result;
+
+    if (!_current->writeLength) {
+        _state = STATE_READ_START;
+        return;
+    }
+
+    result = _wire->llStart((_current->address << 1) | SoftWire::writeMode);
+
+    if (result != SoftWire::ack) {
+        finish(result);
+        return;
+    }
+
+    _index = 0;
+    _state = STATE_WRITE;
+}
+
+void WireMaster::finish(int result)
+{
+    wire_master_transfer_t *transfer = _current;
+
+    if (result != WIRE_MASTER_OK) {
+        _wire->stop();
+    }
+
+    _current = NULL;
+    _state = STATE_IDLE;
+
+    // The callback is invoked last, so that it can submit a new transfer.
+    if (transfer->callback) {
+        transfer->callback(result, _buffer, result == WIRE_MASTER_OK ? transfer->readLength : 0, transfer->arg);
+    }
+}
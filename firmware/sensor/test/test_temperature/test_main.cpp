@@ -0,0 +1,58 @@
+#include <math.h>
+#include <stdint.h>
+
+#include <unity.h>
+
+#include "temperature.h"
+
+// Transfer function of the temperature sensor (LMT86), as it was computed
+// with floating point math before the lookup table.
+static int16_t _convert(uint16_t value, uint16_t reference)
+{
+    double millivolt = value * (reference / 1000.0);
+    double tempC = (13.582 - sqrt(pow(-13.582, 2) + (0.01732) * (2230.8 - millivolt))) / -0.00866 + 30;
+
+    return (int32_t)(tempC * 100.0);
+}
+
+static void _sweep(uint16_t reference)
+{
+    // The whole range of the (10-bit) ADC.
+    for (uint16_t value = 0; value < 1024; value++) {
+        TEST_ASSERT_INT_WITHIN(1, _convert(value, reference), temperatureConvert(value, reference));
+    }
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_reference_3300(void)
+{
+    _sweep(3300);
+}
+
+void test_reference_5000(void)
+{
+    _sweep(5000);
+}
+
+void test_reference_5100(void)
+{
+    _sweep(5100);
+}
+
+int main(void)
+{
+    UNITY_BEGIN();
+
+    RUN_TEST(test_reference_3300);
+    RUN_TEST(test_reference_5000);
+    RUN_TEST(test_reference_5100);
+
+    return UNITY_END();
+}